@@ -18,6 +18,8 @@ Thanks to Lukasz Podkalicki for his PWM example firmware for the ATtiny13 <https
 #include <avr/io.h>             // this contains all the IO port definitions
 #include <avr/interrupt.h>      // definitions for interrupts
 #include <avr/pgmspace.h>       // definitions or keeping constants in program memory
+#include <avr/sleep.h>          // definitions for sleep modes (we sleep between samples, and after the composition)
+#include <avr/power.h>          // clock_prescale_set() (for setting CLKPR)
 
 // this macro is needed for binary numbers on some versions of gcc ("0b" prefix is fine for the gcc that comes with WinAVR)
 #define HEX__(n) 0x##n##UL
@@ -38,19 +40,75 @@ The hardware for this project is very simple:
      ATtiny13a has 8 pins:
        pin 1   no connection
        pin 2   PB3 - blue LED -- through a 1K ohm resistor to +3V
-       pin 3   no connection
+       pin 3   PB4 - (optional) pushbutton or tilt switch to ground -- wakes it up to play again (see PLAY_COUNT)
        pin 4   ground
        pin 5   OC1A (PB0) - to speaker -- through a 1000uF cap to +3V
        pin 6   PB1 - green LED -- through a 1K ohm resistor to +3V
        pin 7   PB2 - red LED -- through a 1K ohm resistor to +3V
        pin 8   +3V (CR2032 through a switch)
 The hardware fits into a 50mm diameter plastic capsule for a gumball machine.
+    (If you add the switch on PB4, use one that is open when the capsule is at rest.
+    PB4 has its internal pull-up turned on (20K to 50K ohms), so a switch that stays
+    closed uses about 60uA to 150uA at 3V.)
 
-    This firmware requires that the clock frequency of the ATtiny13a
-      is:  9.6MHz internal oscillator
+    This firmware uses the 9.6MHz internal oscillator of the ATtiny13a.
+    It sets the clock prescaler (CLKPR) when it starts up, so the CPU runs at
+    F_CPU (set in the Makefile):  9600000, 4800000, 2400000, or 1200000
+    A slower clock uses less battery current, but the PWM runs slower too, so
+    the sound gets a bit buzzier.  All of the timing below is worked out from
+    F_CPU, so the composition plays at the same pitch and tempo at any of them.
+    (And since we set CLKPR ourselves, it does not matter if the CKDIV8 fuse
+    was left programmed.)
 */
 
 
+//--------------------
+// Clock settings
+#define F_OSC  9600000UL  // the internal oscillator (CKSEL1:CKSEL0=10 in the fuses)
+
+// clock prescaler setting to divide F_OSC down to F_CPU (for clock_prescale_set())
+#if   F_CPU == F_OSC
+  #define CLOCK_DIV  clock_div_1   // CLKPS3:CLKPS0=0000 for 9.6MHz
+#elif F_CPU == F_OSC / 2
+  #define CLOCK_DIV  clock_div_2   // CLKPS3:CLKPS0=0001 for 4.8MHz
+#elif F_CPU == F_OSC / 4
+  #define CLOCK_DIV  clock_div_4   // CLKPS3:CLKPS0=0010 for 2.4MHz
+#elif F_CPU == F_OSC / 8
+  #define CLOCK_DIV  clock_div_8   // CLKPS3:CLKPS0=0011 for 1.2MHz
+#else
+  #error "F_CPU must be 9600000, 4800000, 2400000, or 1200000"
+#endif
+
+//--------------------
+// How many times to play the composition before going to sleep
+//   0 = play it over and over until the battery is empty
+//   1 or more = play it this many times, then go into Power-down sleep
+//               (the battery lasts for years in Power-down)
+//               a press on the switch on PB4 wakes it up to play it this many times again
+// (you can also set it for a batch of capsules from the Makefile, like this:  CFLAGS += -DPLAY_COUNT=3 )
+#ifndef PLAY_COUNT
+#define PLAY_COUNT  0
+#endif
+
+
+// Timer0 overflows (and we play a sample) once every 256 clock cycles
+#define SAMPLE_RATE  ( F_CPU / 256 )  // 37500Hz at 9.6MHz ... 4687Hz at 1.2MHz
+
+// Things that change slowly (like LED fades) are done in main() at the "control rate",
+// instead of in the interrupt for every sample
+#define CONTROL_RATE  250  // control ticks per second
+#define CONTROL_DIV   ( (SAMPLE_RATE + CONTROL_RATE/2) / CONTROL_RATE )  // samples per control tick (150 at 9.6MHz)
+
+// the tempo, if NOTE_TIME is 1 (see "Note timing")
+#ifndef TEMPO_BPM
+#define TEMPO_BPM      120   // beats a minute, at the start of the composition
+#endif
+#define TICKS_PER_BEAT  24   // score ticks in each beat
+// this makes the tempoStep for "bpm" beats a minute (the control ticks come
+// every CONTROL_DIV samples, which is not quite CONTROL_RATE a second at every F_CPU)
+#define TEMPO_STEP(bpm)  (uint16_t)( (65536ULL * (bpm) * TICKS_PER_BEAT * CONTROL_DIV) / (60ULL * SAMPLE_RATE) )
+
+
 /*
 -----------------------------------------------------
    PROGMEM and pgm_read_byte() and pgm_read_word()
@@ -63,7 +121,7 @@ RAM when the code starts excecuting (at power on or reset).
 This firmware has fairly large tables that we do not want to transfer into
 RAM:
    gumballWavTab[] -- for storing the waveform to play
-   pitchTab        -- for storing the pitches to play
+   pitchTab[]      -- for storing the pitches to play
 The C compiler needs to be told to keep the tables in program memory.
 To do this we use the PROGMEM macro.  Please see the tables, below, to see
 PROGMEM in use.
@@ -81,13 +139,12 @@ To access the byte in the fourth value in gumballWavTab[] , this is how we
 do it:
      pgm_read_byte( &( gumballWavTab[3] ) );
 
-To access the gumballPitch (which is a byte) in the seventh element of the
-pitchTab[] , this is how we do it:
-     pgm_read_byte( &pitchTab[6].gumballPitch );
+To access the byte at position 6 of pitchTab[] , this is how we do it:
+     pgm_read_byte( &pitchTab[6] );
 
-To access the pitchDuration (which is a word) in the seventh element of
-the pitchTab[] , this is how we do it:
-     pgm_read_word( &pitchTab[6].pitchDuration );
+To access the word (2 bytes) at position 7 of pitchTab[] (the value of a CMD()),
+this is how we do it:
+     pgm_read_word( &pitchTab[7] );
 
 To make use of PROGMEM and the pgm_read_byte() and pgm_read_word() macros
 this file includes pgmspace.h (you'll see that near the top of this file).
@@ -98,7 +155,52 @@ this file includes pgmspace.h (you'll see that near the top of this file).
 //--------------------
 // Gumball waveform table
 //   (this is an interesting sound I created using CoolEdit Pro)
+// and a couple of other wave tables, so the composition can change its sound
+// (see wavBank[], below)
+//
+// The wave table can be stored in a few different ways.  Set WAVE_FORMAT to
+// pick one.  The smaller ones leave more room in flash for more waveforms or
+// a longer composition, but they do not sound quite the same.
+//   WAVE_RAW    -- 1 byte per sample, exactly as it was made
+//   WAVE_PACK4  -- 4 bits per sample (half the size)
+//   WAVE_DELTA  -- 4 bits per sample, each one is a step (from a table of 16) from the sample before it
+//                    (this follows quick changes better than WAVE_PACK4, but it has to play every
+//                    sample in order, so it cannot jump around in the table)
+//   WAVE_MIRROR -- only the first half of the table, the second half plays it backwards
+//                    (this is only good for waveforms that are nearly the same backwards --
+//                    gumballWavTab[] is not one of them!)
+// The tables for the smaller formats are made from gumballWavTab[] by
+// tools/wavcodec.py, which also tells you how different each one sounds:
+// gumballWavTab[] (92 samples), decoded and compared with the original:
+//   raw      92 bytes   rms   0.00   max   0   snr   inf dB
+//   pack4    46 bytes   rms   4.91   max   8   snr  22.5 dB
+//   delta    63 bytes   rms   4.83   max  17   snr  22.6 dB
+//   mirror   46 bytes   rms  49.21   max 114   snr   2.5 dB
+// sineWavTab[] (32 samples), decoded and compared with the original:
+//   raw      32 bytes   rms   0.00   max   0   snr   inf dB
+//   pack4    16 bytes   rms   3.87   max   6   snr  27.3 dB
+//   delta    33 bytes   rms   0.81   max   2   snr  40.9 dB
+//   mirror   16 bytes   rms   0.00   max   0   snr   inf dB
+// pulseWavTab[] (16 samples), decoded and compared with the original:
+//   raw      16 bytes   rms   0.00   max   0   snr   inf dB
+//   pack4     8 bytes   rms   2.55   max   3   snr  31.5 dB
+//   delta    25 bytes   rms   0.00   max   0   snr   inf dB
+//   mirror    8 bytes   rms   0.00   max   0   snr   inf dB
+// (WAVE_DELTA only has gumballWavTab[] -- its table of steps is made just for it)
+//
+// The number of clock cycles it takes the interrupt to get each sample is about:
+//   WAVE_RAW 8,  WAVE_PACK4 14,  WAVE_DELTA 22,  WAVE_MIRROR 12
+#define WAVE_RAW     0
+#define WAVE_PACK4   1
+#define WAVE_DELTA   2
+#define WAVE_MIRROR  3
+#ifndef WAVE_FORMAT
+#define WAVE_FORMAT  WAVE_RAW
+#endif
+
 const uint8_t gumballWavTabSize = 92;
+
+#if WAVE_FORMAT == WAVE_RAW
 const uint8_t gumballWavTab[] PROGMEM = {
   0x8a, 0xb1, 0x55, 0x4d, 0xb2, 0x90, 0x43, 0x8f, 0xb7, 0x4f, 0x54, 0xbd,
   0x8c, 0x35, 0x98, 0xb8, 0x3a, 0x70, 0xcb, 0x4c, 0x51, 0xd7, 0x5d, 0x47,
@@ -109,153 +211,2999 @@ const uint8_t gumballWavTab[] PROGMEM = {
   0x83, 0x65, 0xac, 0x40, 0xc6, 0x30, 0xc2, 0x45, 0xa0, 0x74, 0x6e, 0xa5,
   0x46, 0xba, 0x4b, 0x94, 0x89, 0x56, 0xb7, 0x59
 };
+// a smooth, pure tone
+const uint8_t sineWavTab[] PROGMEM = {
+  0xfe, 0xfa, 0xf0, 0xe2, 0xd1, 0xbc, 0xa5, 0x8c, 0x74, 0x5b, 0x44, 0x2f,
+  0x1e, 0x10, 0x06, 0x02, 0x02, 0x06, 0x10, 0x1e, 0x2f, 0x44, 0x5b, 0x74,
+  0x8c, 0xa5, 0xbc, 0xd1, 0xe2, 0xf0, 0xfa, 0xfe
+};
+// a hollow, reedy pulse wave
+const uint8_t pulseWavTab[] PROGMEM = {
+  0x20, 0x20, 0x20, 0x20, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0,
+  0x20, 0x20, 0x20, 0x20
+};
+
+#elif WAVE_FORMAT == WAVE_PACK4
+// WAVE_PACK4: 92 samples, 2 per byte (made by tools/wavcodec.py)
+const uint8_t gumballWavTab4[] PROGMEM = {
+  0xa8, 0x55, 0x8a, 0x84, 0x5b, 0xb5, 0x38, 0xb9, 0x73, 0x4c, 0xd5, 0x45,
+  0x6c, 0xd3, 0x45, 0x3d, 0xc7, 0xc1, 0x38, 0x1e, 0x9a, 0xe3, 0xd0, 0x84,
+  0x3a, 0x0e, 0x1e, 0x4c, 0x89, 0xa6, 0xc4, 0xd2, 0xd2, 0xc2, 0xa4, 0x86,
+  0x68, 0x4a, 0x3c, 0x4b, 0x79, 0xa6, 0xb4, 0x94, 0x58, 0x5b
+};
+// WAVE_PACK4: 32 samples, 2 per byte (made by tools/wavcodec.py)
+const uint8_t sineWavTab4[] PROGMEM = {
+  0xff, 0xde, 0xbc, 0x8a, 0x57, 0x34, 0x12, 0x00, 0x00, 0x21, 0x43, 0x75,
+  0xa8, 0xcb, 0xed, 0xff
+};
+// WAVE_PACK4: 16 samples, 2 per byte (made by tools/wavcodec.py)
+const uint8_t pulseWavTab4[] PROGMEM = {
+  0x22, 0x22, 0xdd, 0xdd, 0xdd, 0xdd, 0x22, 0x22
+};
+
+#elif WAVE_FORMAT == WAVE_DELTA
+const uint8_t gumballWavTabStart = 0x8a;  // WAVE_DELTA: the first sample
+// WAVE_DELTA: the 16 steps a delta code can pick (made by tools/wavcodec.py)
+const int8_t gumballWavTabSteps[] PROGMEM = {
+  -125, -117, -104,  -95,  -77,  -65,  -49,  -31,   -8,   12,   37,   62,
+    75,   84,  101,  116
+};
+// WAVE_DELTA: 91 delta codes, 2 per byte (made by tools/wavcodec.py)
+const uint8_t gumballWavTabDelta[] PROGMEM = {
+  0x3a, 0xe8, 0x47, 0xac, 0x83, 0x6f, 0xe3, 0x0a, 0xdb, 0x80, 0x11, 0x27,
+  0x62, 0xf3, 0x28, 0xcc, 0xbd, 0x45, 0x54, 0x3a, 0x27, 0xa5, 0xe6, 0xab,
+  0x50, 0x7a, 0x5a, 0xcf, 0x77, 0x2d, 0xe0, 0xb4, 0xc5, 0x03, 0x4e, 0x8a,
+  0xc7, 0x02, 0x2e, 0xd0, 0x87, 0x2b, 0x1f, 0x8c, 0xe6, 0x02
+};
+
+#elif WAVE_FORMAT == WAVE_MIRROR
+// WAVE_MIRROR: the first half of 92 samples (made by tools/wavcodec.py)
+const uint8_t gumballWavTabHalf[] PROGMEM = {
+  0x72, 0xb4, 0x56, 0x6b, 0xa3, 0x6e, 0x7e, 0x6a, 0xae, 0x5e, 0x64, 0xae,
+  0x68, 0x7c, 0x64, 0xbf, 0x3d, 0x8e, 0x98, 0x68, 0x6d, 0x9c, 0x82, 0x45,
+  0xcc, 0x48, 0x8b, 0x7e, 0x98, 0x39, 0xd6, 0x37, 0x94, 0x98, 0x48, 0xae,
+  0x64, 0x80, 0x83, 0x84, 0x5c, 0xbd, 0x2d, 0xce, 0x42, 0x92
+};
+// WAVE_MIRROR: the first half of 32 samples (made by tools/wavcodec.py)
+const uint8_t sineWavTabHalf[] PROGMEM = {
+  0xfe, 0xfa, 0xf0, 0xe2, 0xd1, 0xbc, 0xa5, 0x8c, 0x74, 0x5b, 0x44, 0x2f,
+  0x1e, 0x10, 0x06, 0x02
+};
+// WAVE_MIRROR: the first half of 16 samples (made by tools/wavcodec.py)
+const uint8_t pulseWavTabHalf[] PROGMEM = {
+  0x20, 0x20, 0x20, 0x20, 0xe0, 0xe0, 0xe0, 0xe0
+};
+
+#else
+  #error "WAVE_FORMAT must be WAVE_RAW, WAVE_PACK4, WAVE_DELTA, or WAVE_MIRROR"
+#endif
+
+
+
+//--------------------
+// wavBank[] is the list of the wave tables the composition can play.
+// The wave tables can all be different lengths.  A CMD(CMD_TIMBRE, n) command in
+// pitchTab[] picks wave table number n from here, for the pitches after it.
+// (The pitch values in pitchTab[] set how fast we step through the samples, so
+// a wave table that is half as long sounds an octave higher.)
+struct wavElement {
+  const uint8_t *wavData;  // the wave table (in program memory)
+  uint8_t wavSize;         // how many samples it has
+} const wavBank[] PROGMEM = {
+#if WAVE_FORMAT == WAVE_RAW
+  { gumballWavTab,     gumballWavTabSize },  // 0
+  { sineWavTab,        32 },                 // 1
+  { pulseWavTab,       16 },                 // 2
+#elif WAVE_FORMAT == WAVE_PACK4
+  { gumballWavTab4,    gumballWavTabSize },
+  { sineWavTab4,       32 },
+  { pulseWavTab4,      16 },
+#elif WAVE_FORMAT == WAVE_DELTA
+  { gumballWavTabDelta, gumballWavTabSize },  // (WAVE_DELTA only has this one)
+#elif WAVE_FORMAT == WAVE_MIRROR
+  { gumballWavTabHalf, gumballWavTabSize },
+  { sineWavTabHalf,    32 },
+  { pulseWavTabHalf,   16 },
+#endif
+};
+#define WAV_BANK_COUNT  ( sizeof(wavBank) / sizeof(wavBank[0]) )
+
+// the wave table we are playing right now (set by setTimbre())
+const uint8_t *wavData;
+volatile uint8_t wavSize;
+
+
+
+//--------------------
+// Mip-mapped wave tables
+//
+// A wave table of N samples can have harmonics up to N/2.  When the first
+// voice steps through the table by more than a whole sample each time the
+// interrupt plays one (that happens for the highest pitches at 1.2MHz:
+// gumballPitch 10 steps 1.24 samples), the top harmonics are higher than
+// half the sample rate, and they "alias" -- they come out as wrong, lower
+// notes that are not in the tune.  (At 2.4MHz and above every gumballPitch
+// steps less than a sample, so this never happens.)
+// With MIPMAP=1 there is a "level 1" copy of each wave table that is half as
+// long, with the harmonics that will not fit taken out, made by
+// tools/wavmip.py.  For each pitch, mipPick() halves the phase step (and
+// plays the half-length copy) until the step is less than a whole sample, so
+// the pitch stays the same, but nothing in the table can alias.  This is all
+// done in main() when a pitch starts, so the interrupt does not take any
+// longer (and the short table needs fewer samples for each cycle of the
+// waveform).
+// tools/wavmip.py only makes a level if it keeps at least half of the sound:
+// gumballWavTab[] is nearly all high harmonics (it would go almost silent),
+// so it has no level 1 -- its place in wavMip[] is 0, and the whole table is
+// played.  Run "python3 tools/wavmip.py GumballSound.c 2" to make 2 levels.
+// Plucked strings, phase modulation, and bytebeat always use the whole table.
+// It works best together with INTERP=1 and INTERP_PITCH=10 (so the highest
+// pitches are interpolated too) -- otherwise the steps from one sample to the
+// next alias as well, and they are just as loud.  Measured at 1.2MHz for
+// pulseWavTab[] at gumballPitch 10, the sound that is aliased goes from 6.7%
+// to 6.2% with MIPMAP on its own, and from 1.5% (INTERP on its own) to 0.13%
+// with both.
+// The level 1 tables take 24 bytes of flash, and it takes 2 bytes of RAM.
+// With MIPMAP=0 (the default) it is left out completely.
+#ifndef MIPMAP
+#define MIPMAP   0   // 1 to play shorter, smoother wave tables for the highest pitches
+#endif
+#if MIPMAP && WAVE_FORMAT != WAVE_RAW
+  #error "MIPMAP can only be used with WAVE_RAW"
+#endif
+#if MIPMAP && VOICES > 1
+  #error "MIPMAP can only be used with VOICES=1 (the other voices play the same wave table)"
+#endif
+#if MIPMAP && WINDOW
+  #error "MIPMAP cannot be used with WINDOW"
+#endif
+
+#if MIPMAP
+#define MIP_LEVELS  1   // (made by tools/wavmip.py)
+// MIPMAP level 1: 16 samples, harmonics 1 to 7 (made by tools/wavmip.py)
+const uint8_t sineWavTabMip1[] PROGMEM = {
+  0xfe, 0xf0, 0xd1, 0xa5, 0x74, 0x44, 0x1e, 0x07, 0x02, 0x10, 0x2f, 0x5b,
+  0x8c, 0xbc, 0xe2, 0xf9
+};
+// MIPMAP level 1: 8 samples, harmonics 1 to 3 (made by tools/wavmip.py)
+const uint8_t pulseWavTabMip1[] PROGMEM = {
+  0x2b, 0x11, 0xb0, 0xef, 0xd5, 0xef, 0x50, 0x11
+};
+// the levels of each wave table in wavBank[] (made by tools/wavmip.py)
+const uint8_t * const wavMip[][MIP_LEVELS] PROGMEM = {
+  { 0 },  // gumballWavTab[]
+  { sineWavTabMip1 },  // sineWavTab[]
+  { pulseWavTabMip1 }   // pulseWavTab[]
+};
+
+uint8_t wavTimbre;   // which wave table in wavBank[] we are playing (set by setTimbre())
+uint8_t mipLevel;    // which level of it we are playing (0 for the whole table) -- set by mipPick()
+#endif
+
+
+
+#if WAVE_FORMAT == WAVE_DELTA
+//--------------------
+// This function gets the step to add to sample i-1 to make sample i
+// (sample 0 is gumballWavTabStart)
+static inline uint8_t wavDelta(uint8_t i) {
+  uint8_t codes = pgm_read_byte( &( gumballWavTabDelta[(i - 1) >> 1] ) );
+  if ( ((i - 1) & 1) != 0 ) {
+    codes >>= 4;   // odd codes are in the high nibble
+  }
+  return pgm_read_byte( &( gumballWavTabSteps[codes & B8(00001111)] ) );
+}
+#else
+//--------------------
+// This function gets sample i of a wave table that has size samples (whichever way it is stored)
+static inline uint8_t wavRead(const uint8_t *data, uint8_t size, uint8_t i) {
+#if WAVE_FORMAT == WAVE_RAW
+  return pgm_read_byte( data + i );
+#elif WAVE_FORMAT == WAVE_PACK4
+  uint8_t s = pgm_read_byte( data + (i >> 1) );
+  if ( (i & 1) != 0 ) {
+    s >>= 4;       // odd samples are in the high nibble
+  }
+  s &= B8(00001111);
+  return s | (s << 4);   // 0 plays as 0x00, 15 plays as 0xff
+#elif WAVE_FORMAT == WAVE_MIRROR
+  if ( i >= ((size + 1) >> 1) ) {
+    i = (size - 1) - i;   // the second half plays backwards
+  }
+  return pgm_read_byte( data + i );
+#endif
+}
+
+
+
+//--------------------
+// This function gets sample i of the wave table we are playing
+static inline uint8_t wavSample(uint8_t i) {
+  return wavRead(wavData, wavSize, i);
+}
+#endif
+
+
+
+//--------------------
+// Commands that can go in pitchTab[] (with CMD(), below)
+#define CMD_END      0   // the end of the composition (this one is VM_END in pitchTab[])
+#define CMD_TIMBRE   1   // change to another wave table
+#define CMD_VOICE2   2   // set the pitch of voice 2 (if VOICES is 2 or more)
+#define CMD_VOICE3   3   // set the pitch of voice 3 (if VOICES is 3)
+#define CMD_NOISE    4   // set the noise channel (if NOISE is 1)
+#define CMD_ENV      5   // set the envelope of the pitches after this (if ENVELOPE is 1)
+#define CMD_PLUCK    6   // play the pitches after this as plucked strings (if KARPLUS is 1)
+#define CMD_BEAT     7   // play the pitches after this with a bytebeat formula (if BYTEBEAT is 1)
+#define CMD_FM       8   // set the phase modulation of the pitches after this (if FM is 1)
+#define CMD_WINDOW   9   // play the pitches after this from part of the wave table (if WINDOW is 1)
+#define CMD_ARP     10   // play the pitches after this as arpeggios (if ARPEGGIO is 1)
+#define PITCH_LOWEST 10  // gumballPitch values from here up are pitches (the command numbers can go higher, see vmNext())
+
+// this makes the value for a CMD(CMD_NOISE, value) command (see "Noise channel" below)
+#define NOISE_SET(period, mix, mode)  ( (uint16_t)(period) | ((uint16_t)((mix) | (mode)) << 8) )
+#define NOISE_LONG   0x00   // mode: a hiss
+#define NOISE_SHORT  0x80   // mode: a buzzy, metallic noise
+
+// this makes the value for a CMD(CMD_ENV, value) command (see "Envelope" below)
+#define ENV_SET(attack, decay, sustain, release) \
+  ( (uint16_t)(attack) | ((uint16_t)(decay) << 4) | ((uint16_t)(sustain) << 8) | ((uint16_t)(release) << 12) )
+
+// the values for a CMD(CMD_PLUCK, value) command (see "Plucked strings" below)
+#define PLUCK_OFF    0   // play the wave table, as usual
+#define PLUCK_NOISE  1   // pluck the string with a burst of noise
+#define PLUCK_WAVE   2   // pluck the string with the wave table
+
+// this makes the value for a CMD(CMD_FM, value) command (see "Phase modulation" below)
+#define FM_SET(ratio, depth)  ( (uint16_t)(ratio) | ((uint16_t)(depth) << 4) )
+
+// this makes the value for a CMD(CMD_WINDOW, value) command (see "Wave table window" below)
+#define WINDOW_SET(start, length, drift) \
+  ( (uint16_t)(start) | ((uint16_t)((length) >> 1) << 7) | ((uint16_t)(drift) << 13) )
+
+// this makes the value for a CMD(CMD_ARP, value) command (see "Arpeggio" below)
+#define ARP_SET(note1, note2, note3, speed) \
+  ( (uint16_t)(note1) | ((uint16_t)(note2) << 4) | ((uint16_t)(note3) << 8) | ((uint16_t)(speed) << 12) )
+
+
+
+//--------------------
+// pitchTab[] is the composition.
+// It is a little program for a tiny "score player" (a virtual machine, or VM)
+// in main().  Each step of the program starts with a byte that says what to do:
+//   NOTE(gumballPitch, pitchDuration)  -- play a pitch (2 bytes)
+//        gumballPitch is a number between 10 and 255
+//           10 is the highest pitch (and is played the fasted)
+//           255 is the lowest pitch (and takes the longest to play)
+//        pitchDuration is the length of time to repeat playing this pitch
+//           useful values are between 40 (very short) and NOTE_LONGEST (4063)
+//           (it is stored in 1 byte, so it gets rounded a little -- see NOTE_LEN)
+//        NOTE: for lower-pitch sounds (a high gumballPitch value)
+//                 a given pitchDuration will take longer to play
+//                 (unless NOTE_TIME is 1 -- then pitchDuration is in score ticks, see "Note timing")
+//   LONGNOTE(gumballPitch, pitchDuration)  -- the same, for a pitchDuration up to 65535,
+//                             or one that must not be rounded (4 bytes)
+//   CMD(command, value)  -- do a command (4 bytes):
+//     CMD(CMD_TIMBRE, n)  -- play the pitches after this with wave table n in wavBank[]
+//                             (the composition starts with wave table 0, gumballWavTab[])
+//     CMD(CMD_VOICE2, p)  -- start voice 2 playing pitch p (a gumballPitch value), under the pitches after this
+//                             (p=0 makes it quiet -- the composition starts with voices 2 and 3 quiet)
+//     CMD(CMD_VOICE3, p)  -- the same for voice 3
+//     CMD(CMD_NOISE, NOISE_SET(period, mix, mode))  -- set the noise channel (see NOISE_SET)
+//                             (CMD(CMD_NOISE, 0) turns it off -- the composition starts with it off)
+//     CMD(CMD_ENV, ENV_SET(attack, decay, sustain, release))  -- give the pitches after this an envelope (see ENV_SET)
+//                             (CMD(CMD_ENV, 0) plays them at full volume -- the composition starts that way)
+//     CMD(CMD_PLUCK, m)   -- play the pitches after this as plucked strings (m is PLUCK_NOISE or PLUCK_WAVE),
+//                             or with the wave table again (m is PLUCK_OFF -- the composition starts that way)
+//     CMD(CMD_BEAT, n)    -- play the pitches after this with bytebeat formula n in beatBank[] (1 is the first one),
+//                             or with the wave table again (n=0 -- the composition starts that way)
+//     CMD(CMD_FM, FM_SET(ratio, depth))  -- phase modulate the pitches after this (see FM_SET)
+//                             (CMD(CMD_FM, 0) turns it off -- the composition starts with it off)
+//     CMD(CMD_WINDOW, WINDOW_SET(start, length, drift))  -- play the pitches after this from part of the wave table
+//                             (CMD(CMD_WINDOW, 0) plays all of it -- the composition starts that way)
+//     CMD(CMD_ARP, ARP_SET(note1, note2, note3, speed))  -- play the pitches after this as fast
+//                             arpeggios, so they sound like chords (see ARP_SET)
+//                             (CMD(CMD_ARP, 0) turns it off -- the composition starts with it off)
+//   GLIDE(from, to, ticks)  -- slide smoothly from pitch "from" to pitch "to" (gumballPitch values),
+//                             taking "ticks" control ticks (CONTROL_RATE a second) (5 bytes, if PORTAMENTO is 1)
+//   TEMPO(bpm)     -- play the NOTE()s after this at "bpm" beats a minute (3 bytes, if NOTE_TIME is 1)
+//   VIBRATO(depth, rate)  -- wobble the pitch of the NOTE()s after this (see "Vibrato") -- VIBRATO(0, 0)
+//                             stops it (the composition starts without it) (2 bytes, if LFO is 1)
+//   CALL(at)       -- play the phrase that starts at byte number "at" in pitchTab[], then come back (2 bytes)
+//   REPEAT(n, at)  -- the same, but play the phrase n times (3 bytes)
+//   RET            -- the end of a phrase: go back to where it was called from (1 byte)
+//   JUMP(at)       -- go on from byte number "at" in pitchTab[] (2 bytes)
+//   END            -- the end of the composition (1 byte)
+// So a phrase that is played more than once only has to be stored once.
+// Counting the bytes for CALL() and JUMP() by hand is no fun, so pitchTab[]
+// is made by tools/scoreasm.py from score.txt (which has names for the
+// phrases instead), and it tells you how many bytes the phrases saved (and
+// how many the 2-byte NOTE() saved -- which is all of it for score.txt, since
+// it has no phrases).
+// A phrase can CALL another phrase, but only VM_DEPTH deep.
+//
+// The byte that starts each step is a gumballPitch for NOTE(), or less than
+// PITCH_LOWEST for the others.
+//
+// A NOTE() keeps its pitchDuration in 1 byte, as a tiny floating point number
+// (like a logarithm): the top 3 bits are how far to shift, and the low 5 bits
+// are the number to shift.  So the steps between the lengths it can store
+// grow with the length -- 1 up to 63, 2 up to 127, 4 up to 255, and so on up
+// to 64 at the top -- and a length is never more than 1.6% out, which you
+// cannot hear.  NOTE_LEN() does the rounding when the program is compiled,
+// and noteLength() turns the byte back into a length as it plays.
+// (Before, a NOTE() was 3 bytes: most of the 16 bits for the length were
+// never used, since the lengths are all between 40 and 2000.)
+#define NOTE_LONGEST  4063
+#define NOTE_SHIFT(d) ( (d) < 64 ? 0 : (d) < 128 ? 1 : (d) < 256 ? 2 : (d) < 512 ? 3 : \
+                        (d) < 1024 ? 4 : (d) < 2048 ? 5 : 6 )
+#define NOTE_LEN(d)   (uint8_t)( (NOTE_SHIFT(d) << 5) + \
+                        (((d) + ((1 << NOTE_SHIFT(d)) >> 1)) >> NOTE_SHIFT(d)) )
+#define VM_END      0
+#define VM_CMD      1
+#define VM_CALL     2
+#define VM_REPEAT   3
+#define VM_RET      4
+#define VM_JUMP     5
+#define VM_GLIDE    6
+#define VM_LONGNOTE 7
+#define VM_TEMPO    8
+#define VM_VIBRATO  9
+
+#define NOTE(pitch, duration)  (pitch), NOTE_LEN(duration)
+#define LONGNOTE(pitch, duration) VM_LONGNOTE, (pitch), (uint8_t)(duration), (uint8_t)((duration) >> 8)
+#define CMD(command, value)    VM_CMD, (command), (uint8_t)(value), (uint8_t)((value) >> 8)
+#define CALL(at)               VM_CALL, (at)
+#define REPEAT(n, at)          VM_REPEAT, (n), (at)
+#define RET                    VM_RET
+#define JUMP(at)               VM_JUMP, (at)
+#define GLIDE(from, to, ticks) VM_GLIDE, (from), (to), (uint8_t)(ticks), (uint8_t)((ticks) >> 8)
+#define TEMPO(bpm)             VM_TEMPO, (uint8_t)TEMPO_STEP(bpm), (uint8_t)(TEMPO_STEP(bpm) >> 8)
+#define VIBRATO(depth, rate)   VM_VIBRATO, (uint8_t)( ((depth) << 4) | (rate) )
+#define END                    VM_END
+
+// made by tools/scoreasm.py from score.txt
+// pitchTab[]: 145 bytes (the 72 notes and commands it plays would take 219 bytes as a flat table), 74 bytes saved
+// (74 saved by the smaller steps, like the 2-byte NOTE(), and 0 saved by the phrases)
+// 28 note lengths are rounded to fit in 1 byte (the most is 130, by 1.5%)
+#define PITCH_TAB_TICKS  0   // 1 if the lengths are in score ticks (for NOTE_TIME=1)
+const uint8_t pitchTab[] PROGMEM = {
+  NOTE(100, 280), NOTE(150, 250), NOTE(180, 300), NOTE(90, 800), NOTE(120, 500),
+  NOTE(200, 50), NOTE(120, 280), NOTE(95, 282), NOTE(90, 285), NOTE(180, 350),
+  NOTE(150, 380), NOTE(120, 280), NOTE(95, 410), NOTE(90, 285), NOTE(70, 500),
+  NOTE(200, 50), NOTE(70, 180), NOTE(65, 1000), NOTE(70, 150), NOTE(80, 180),
+  NOTE(90, 285), NOTE(80, 270), NOTE(12, 50), NOTE(50, 2000), NOTE(200, 500),
+  NOTE(80, 500), NOTE(100, 500), NOTE(255, 800), NOTE(100, 100), NOTE(96, 100),
+  NOTE(92, 100), NOTE(88, 200), NOTE(84, 250), NOTE(80, 300), NOTE(77, 350),
+  NOTE(74, 400), NOTE(71, 200), NOTE(68, 200), NOTE(65, 200), NOTE(62, 200),
+  NOTE(59, 190), NOTE(56, 180), NOTE(53, 170), NOTE(53, 160), NOTE(50, 150),
+  NOTE(48, 140), NOTE(46, 130), NOTE(44, 120), NOTE(42, 110), NOTE(40, 100),
+  NOTE(38, 100), NOTE(36, 100), NOTE(34, 100), NOTE(32, 100), NOTE(30, 100),
+  NOTE(28, 100), NOTE(26, 100), NOTE(24, 100), NOTE(22, 90), NOTE(20, 70),
+  NOTE(18, 60), NOTE(16, 50), NOTE(14, 40), NOTE(10, 100), NOTE(16, 50),
+  NOTE(20, 70), NOTE(36, 100), NOTE(50, 150), NOTE(62, 200), NOTE(71, 200),
+  NOTE(80, 150), NOTE(92, 130), END
+};
+// the lengths in pitchTab[] must be in the units the firmware counts them in (see "Note timing")
+#if NOTE_TIME && !PITCH_TAB_TICKS
+  #error "NOTE_TIME needs the lengths in pitchTab[] in score ticks -- make it with tools/scoreasm.py --to-ticks"
+#elif !NOTE_TIME && PITCH_TAB_TICKS
+  #error "the lengths in pitchTab[] are in score ticks, so it needs NOTE_TIME=1"
+#endif
 
 
 
 //--------------------
-// pitchTab[] is a one-dimensional array.
-// pitchTab[] is a table of values for pitches to play, and the duration of how long to play the pitch
-struct pitchElement {
-  // each pitchElement in this table has two values:
-  uint8_t gumballPitch;    // this is a number between 10 and 255
-                           //    10 is the highest pitch (and is played the fasted)
-                           //    255 is the lowest pitch (and takes the longest to play)
-  uint16_t pitchDuration;  // length of time to repeat playing this pitch
-                           //    useful values are between 200 (very short) and 65535 (very long)
-                           // NOTE: for lower-pitch sounds (a high gumballPitch value)
-                           //          a given pitchDuration will take longer to play
-// the last element in the table has its gumballPitch = 0
-} const pitchTab[] PROGMEM = {
-  { 100,  280 },  { 150,  250 },  { 180,  300 },  {  90,  800 },  { 120,  500 },
-  { 200,   50 },  { 120,  280 },  {  95,  282 },  {  90,  285 },  { 180,  350 },
-  { 150,  380 },  { 120,  280 },  {  95,  410 },  {  90,  285 },  {  70,  500 },
-  { 200,   50 },  {  70,  180 },  {  65, 1000 },  {  70, 150  },  {  80,  180 },
-  {  90,  285 },  {  80,  270 },  {  12,   50 },  {  50, 2000 },  { 200,  500 },
-  {  80,  500 },  { 100,  500 },  {  255, 800 },  { 100,  100 },  {  96,  100 },
-  {  92,  100 },  {  88,  200 },  {  84,  250 },  {  80,  300 },  {  77,  350 },
-  {  74,  400 },  {  71,  200 },  {  68,  200 },  {  65,  200 },  {  62,  200 },
-  {  59,  190 },  {  56,  180 },  {  53,  170 },  {  53,  160 },  {  50,  150 },
-  {  48,  140 },  {  46,  130 },  {  44,  120 },  {  42,  110 },  {  40,  100 },
-  {  38,  100 },  {  36,  100 },  {  34,  100 },  {  32,  100 },  {  30,  100 },
-  {  28,  100 },  {  26,  100 },  {  24,  100 },  {  22,   90 },  {  20,   70 },
-  {  18,   60 },  {  16,   50 },  {  14,   40 },  {  10,  100 },  {  16,   50 },
-  {  20,   70 },  {  36,  100 },  {  50,  150 },  {  62,  200 },  {  71,  200 },
-  {  80,  150 },  {  92,  130 },
-  {   0,    0 }
+// ledTrack[] is the light show that goes with the composition.
+// It is kept separate from pitchTab[], so you can change the lights without
+// changing the music (and the other way round).
+// Each step in the light show lasts for a number of pitches (elements of
+// pitchTab[]), and says:
+//   which LEDs to toggle each time the waveform in gumballWavTab[] repeats
+//     (and how often: rate=0 is every time, 1 is every 2nd time, 2 every 4th, ... 7 every 128th)
+//   which LEDs to toggle at the start of each pitch
+// When the light show reaches the end (ledNotes=0) it starts over from the
+// beginning, so a short light show can loop all the way through a long composition.
+// (This one was made to blink just like the old firmware did -- it used to work out
+// which LEDs to blink from the pitch values.)
+#define LED_GREEN  B8(00000010)  // LED at PB1 (green)
+#define LED_RED    B8(00000100)  // LED at PB2 (red)
+#define LED_BLUE   B8(00001000)  // LED at PB3 (blue)
+
+struct ledElement {
+  // each ledElement in this table has two bytes, packed together by LED_STEP():
+  uint8_t ledNotes;  // bits 4:0 -- how many pitches this step lasts for (1 to 31, or 0 at the end of the table)
+                     // bits 7:5 -- rate (how often to toggle the LEDs when the waveform repeats)
+  uint8_t ledShow;   // bits 3:1 -- LEDs to toggle when the waveform repeats (PB1, PB2, PB3)
+                     // bits 7:5 -- LEDs to toggle at the start of each pitch (PB1, PB2, PB3, shifted up by 4)
+};
+#define LED_STEP(notes, rate, wrapLEDs, noteLEDs)  { ((rate) << 5) | (notes), (wrapLEDs) | ((noteLEDs) << 4) }
+
+const struct ledElement ledTrack[] PROGMEM = {
+  LED_STEP(  3, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),
+  LED_STEP(  3, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),  LED_STEP(  3, 0, LED_RED|LED_GREEN,  LED_BLUE ),
+  LED_STEP(  1, 0, 0,                  LED_BLUE ),  LED_STEP(  2, 0, LED_GREEN,          LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),
+  LED_STEP(  1, 0, 0,                  LED_BLUE ),  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  4, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  4, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP( 10, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  4, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  4, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),  LED_STEP(  4, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  3, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_GREEN,          LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  2, 0, 0,                  LED_BLUE ),
+  LED_STEP(  1, 0, LED_RED|LED_GREEN,  LED_BLUE ),  LED_STEP(  1, 0, 0,                  LED_BLUE ),
+  LED_STEP(  0, 0, 0,                  0 )
 };
 
 
 
 //--------------------
-// This delay function delays units of time.
-// The units have longer duration when delCount is bigger.
-//   units can be between 0 and 65535
-//   delCount can be between 0 and 65535
-#define TENTH_MS    112   // when delCount is 112, the units of time are: 1/10 millisecond
-#define SAMP         10   // when delCount is 10, it is a good amount for delaying between outputting samples from the waveform wave table
-#define ONE_SEC   10000   // when units=ONE_SEC and delCount=TENTH_MS, the delay will be 1 second
-void delaySomeTime(unsigned long int units, unsigned long int delayCount) {
-  unsigned long int timer;
+// The LED engine
+//
+// The LEDs (PB1 (green), PB2 (red), PB3 (blue)) are dimmed with software PWM.
+// Each LED goes from +3V (through its 1K resistor) to its pin, so it is lit
+// while the pin is low, and off while the pin is high.
+// Each time the Timer0 interrupt plays a sample it also counts ledPwmCount
+// from 0 up to LED_LEVELS-1 (and back round to 0), and drives each LED's pin
+// low only while ledPwmCount is less than that LED's brightness (its ledLevel[]).  So
+// an LED with ledLevel=4 is on for 4 out of every 16 samples (1/4 of the time).
+// The PWM repeats at SAMPLE_RATE/16 (2344Hz at 9.6MHz, 293Hz at 1.2MHz), which
+// is far too fast to see any flicker.
+//
+// Which LEDs are lit is set by the bits in ledOn (the same bit numbers as in
+// PORTB, but a 1 in ledOn means lit, which is a 0 in PORTB).
+// ledUpdate() runs at the control rate (CONTROL_RATE times per second), and
+// fades each LED's brightness up towards LED_BRIGHT when its bit in ledOn is
+// set, or down towards 0 when it is clear, by LED_FADE each time.
+//
+// The LEDs use most of the battery current (about 1mA each, when fully on).
+// An LED only draws current while its pin is low, and a lower LED_BRIGHT keeps
+// the pin low for less of each PWM cycle, so it makes the battery last a lot longer.
+//
+// A CR2032 cannot give much current at once (it has a lot of internal
+// resistance), so when all 3 LEDs are on while the speaker is playing, the
+// battery voltage dips.  That makes the internal oscillator (and the pitch)
+// wobble, and on a half-used battery it can even reset the ATtiny13a.
+// LED_MAX_LIT sets how many LEDs can ever be on at the same time (the peak LED
+// current is about LED_MAX_LIT mA).  When it is less than 3, the interrupt
+// scans round the LEDs: each LED (or pair of LEDs) gets its turn for one PWM
+// cycle, which goes round fast enough (781Hz at 9.6MHz) to look like they are
+// all on together.  Each LED is then only on for part of the time, so it looks
+// dimmer, and it uses less current too.
+//   LED_MAX_LIT=3 -- no scanning (all 3 LEDs can be on at once)
+//   LED_MAX_LIT=2 -- 2 LEDs at most (each LED gets 2 turns out of 3)
+//   LED_MAX_LIT=1 -- 1 LED at most (each LED gets 1 turn out of 3)
+#define LED_LEVELS  16   // number of brightness levels (this must be a power of 2)
+#ifndef LED_BRIGHT
+#define LED_BRIGHT  16   // how bright the LEDs get when they are on (0 to LED_LEVELS) -- 8 would keep the pins low half the time, for half the current
+#endif
+#ifndef LED_FADE
+#define LED_FADE     2   // how much the brightness changes each control tick (LED_LEVELS fades instantly, like just toggling)
+#endif
+#ifndef LED_MAX_LIT
+#define LED_MAX_LIT  3   // how many LEDs can be on at the same time (1, 2, or 3)
+#endif
+#if LED_MAX_LIT < 1 || LED_MAX_LIT > 3
+  #error "LED_MAX_LIT must be 1, 2, or 3"
+#endif
+#define LED_MASK   B8(00001110)  // the LEDs are on PB1, PB2, PB3
+
+volatile uint8_t ledOn;       // which LEDs are lit (PB1 (green), PB2 (red), PB3 (blue))
+volatile uint8_t ledLevel[3]; // the brightness of each LED right now (PB1, PB2, PB3)
+uint8_t ledPwmCount;          // counts 0 to LED_LEVELS-1 for the software PWM (only used by the interrupt)
+#if LED_MAX_LIT < 3
+uint8_t ledScan = LED_GREEN;  // whose turn it is in the LED scan (only used by the interrupt)
+#endif
+
+// ledTrack[] (the light show) is played by ledNextPitch() and the interrupt
+volatile uint8_t wrapLEDs;    // which LEDs to toggle each time the waveform repeats
+volatile uint8_t wrapEvery;   //   every this many times
+uint8_t wrapCount = 1;        // counts down to the next toggle (only used by the interrupt)
+uint8_t ledIndex;             // index into ledTrack[]
+uint8_t ledNotesLeft;         // how many more pitches this step of the light show lasts for
+uint8_t noteLEDs;             // which LEDs to toggle at the start of each pitch
+
+
 
-  while (units != 0) {
-    // Toggling PB5 is done here to force the compiler to do this loop, rather than optimize it away
-    for (timer=0; timer <= delayCount; timer++) {PINB |= B8(00100000);};
-    units--;
+//--------------------
+// The interrupt calls this each time the waveform repeats,
+// to toggle the LEDs that the light show (ledTrack[]) says to
+static inline void ledWrapped(void) {
+  if (--wrapCount == 0) {
+    wrapCount = wrapEvery;
+    ledOn ^= wrapLEDs;
   }
 }
 
 
 
 //--------------------
-// This function blinks the LEDs (connected to PB1 (green), PB2 (red), PB3 (blue) )
-//   at the rate determined by onTime and offTime
-// This function also acts as a delay for the Duration specified (onTime+offTime)
-// onTime = time the LEDs are on (divde by 10 to get msec)
-// offTime = time the LEDs are off (divde by 10 to get msec)
-void blink_LEDs( unsigned long int duration, unsigned long int onTime, unsigned long int offTime) {
-  for (int i=0; i<(duration/(onTime+offTime)); i++) {
-    PORTB |= B8(00001110);             // turn on LEDs at PB1, PB2, PB3
-    delaySomeTime(onTime, TENTH_MS);   //   for onTime
-    PORTB &= B8(11110001);             // turn off LEDs at PB1, PB2, PB3
-    delaySomeTime(offTime, TENTH_MS);  //   for offTime
+// This function moves the light show on by one pitch.
+// It is called at the start of each pitch.
+void ledNextPitch(void) {
+  uint8_t notes;
+  uint8_t show;
+
+  if (ledNotesLeft == 0) {
+    // time for the next step in ledTrack[] (or back to the first one, if we reached the end)
+    notes = pgm_read_byte( &( ledTrack[ledIndex].ledNotes ) );
+    if (notes == 0) {
+      ledIndex = 0;
+      notes = pgm_read_byte( &( ledTrack[0].ledNotes ) );
+    }
+    show = pgm_read_byte( &( ledTrack[ledIndex].ledShow ) );
+    ledIndex++;
+    ledNotesLeft = notes & B8(00011111);
+    noteLEDs = (show >> 4) & LED_MASK;
+    // the interrupt uses these values, so make sure it does not run while we change them
+    cli();
+    wrapLEDs = show & LED_MASK;
+    wrapEvery = 1 << (notes >> 5);
+    wrapCount = 1;
+    sei();
   }
+  ledNotesLeft--;
+
+  cli();
+  ledOn ^= noteLEDs;
+  sei();
 }
 
 
 
 //--------------------
-int main(void) {
+// This function fades the LEDs towards the brightness they should be.
+// It runs at the control rate (not for every sample), so it does not slow the interrupt down.
+void ledUpdate(void) {
+  uint8_t on = ledOn;
+  uint8_t ledBit = _BV(PB1);
 
-  uint8_t  gumIndex;    // index into gumballWavTab[]
-  uint8_t  gumWavDat;   // values read from gumballWavTab[]
-  uint8_t  pitchIndex;  // index into pitchTab[]
-  uint8_t  pitchRate;   // values read from pitchTab[].gumballPitch (the rate at which to play the waveform in gumballWavTab[])
-  uint16_t pitchLen;    // values read from pitchTab[].pitchDuration (the length of time to play a pitch)
+  for (uint8_t i=0; i<3; i++) {
+    uint8_t level = ledLevel[i];
+    if (on & ledBit) {
+      // fade up (but not past LED_BRIGHT)
+      level = (level + LED_FADE < LED_BRIGHT) ? level + LED_FADE : LED_BRIGHT;
+    } else {
+      // fade down (but not past 0)
+      level = (level > LED_FADE) ? level - LED_FADE : 0;
+    }
+    ledLevel[i] = level;
+    ledBit <<= 1;
+  }
+}
 
-  // initialize Timer0 in Fast PWM mode (from BOT (0x00) to MAX (0xFF) with Compare Match on OC0A value),
-  // with OC0A outputting on PB0 pin, with no prescaling
-  DDRB |= _BV(PB0);                // set OC0A PWM pin (PB0) as output
-  TCCR0A |= _BV(COM0A1);           // TCCR0A -- COM0A1:COM0A0=10 to clear OC0A on Compare Match, set OC0A at TOP
-                                   // TCCR0A -- COM0B1:COM0B0=00 for Timer0 OC0B disconnected
-                                   // TCCR0A -- bits 3:2 are unused
-  TCCR0A |= _BV(WGM01)|_BV(WGM00); // TCCR0A -- WGM01:WGM00=11 for Fast PWM mode (BOT to MAX, with Compare Match on OC0A value)
-                                   // TCCR0B -- FOC0A=0 for no force compare for Timer0 OC0A
-                                   // TCCR0B -- FOC0B=0 for no force compare for Timer0 OC0B
-                                   // TCCR0B -- bits 5:4 are unused
-                                   // TCCR0B -- WGM02=0 for Fast PWM mode (BOT to MAX, with Compare Match on OC0A value)
-  TCCR0B |= _BV(CS00);             // TCCR0B -- CS02:CS00=001 for prescaling=1 (no prescaling)
 
-  // initialize PB1 (green), PB2 (red), PB3 (blue) as outputs (for LEDs)
-  DDRB |= _BV(PB1)|_BV(PB2)|_BV(PB3);
 
-  // repeat playing all of the pitches in the pitchTab[] forever
-  while (1) {
-    gumIndex = 0;
-    pitchIndex = 0;
+//--------------------
+// The sample engine
+//
+// The waveform in gumballWavTab[] is played by the Timer0 Overflow interrupt.
+// Timer0 runs in Fast PWM mode with no prescaling, so it overflows once every
+// 256 clock cycles (SAMPLE_RATE).  Every time it overflows the interrupt
+// routine (below) sends the next sample to OCR0A, and then steps a "phase
+// accumulator" forward by phaseInc.
+//
+// The phase accumulator is a fixed-point number:
+//   gumIndex  is the whole part    -- the index into gumballWavTab[]
+//   phaseFrac is the fraction part -- 65536 means "one whole sample"
+// phaseInc is split the same way (phaseIncWhole and phaseIncFrac).  Each time
+// phaseFrac overflows (carries) we move on one more sample in the wave table.
+// So the pitch is set exactly by phaseInc, and it does not depend on how the
+// compiler happens to build the code.
+//
+// The old firmware held each sample for delaySomeTime(gumballPitch, 10), which
+// went 11 times round a 32-bit counting loop for each unit of gumballPitch.
+// At 9.6MHz that came to about 165 clock cycles (17.2 microseconds) per unit,
+// which is what made the composition 28 seconds long.  To keep the composition
+// sounding the same we step through the wave table at that same rate, whatever
+// F_CPU is:
+//   samples per Timer0 overflow = PITCH_UNIT_HZ / (gumballPitch * SAMPLE_RATE)
+// and in units of phaseFrac (65536 per sample) this is PHASE_STEP_K / gumballPitch.
+// (At 9.6MHz that is less than one sample per overflow, but at 1.2MHz the
+// highest pitches step more than one whole sample each time.)
+#define PITCH_UNIT_HZ  ( F_OSC / 165 )  // units of gumballPitch per second (58182, about 17.2 microseconds each)
+#define PHASE_STEP_K   ( (uint32_t)( (65536ULL * PITCH_UNIT_HZ) / SAMPLE_RATE ) )  // 101680 at 9.6MHz, 813440 at 1.2MHz
 
-    // create Gumball waveform using PWM by continually sequencing through the waveform sample values in gumballWavTab[]
-    // vary the playback rate to vary the pitch of the waveform with the values in pitchTab[].gumballPitch
-    // vary the lengths of time for playing a pitch with the values in pitchTab[].pitchDuration
-    pitchRate = pgm_read_byte( &( pitchTab[pitchIndex].gumballPitch ) );
-    pitchLen = pgm_read_word( &( pitchTab[pitchIndex].pitchDuration ) );
-
-    // this "while" loop plays elements in the pitchTab[]
-    // each element has a pitch-rate (how fast to play back the waveform) and a pitch-length (how long to play the pitch)
-    // (the last element has pitchRate=0, so we keep looping until pitchRate!=0)
-    while (pitchRate != 0) {
-      // this "for" loop continually plays the samples of the gumball waveform from gumballWavTab[]
-      // --the playback rate (the pitch) is determined by pitchRate (which is the Pitch value from pitchTab[] )
-      // --the playback duration (how long to play this pitch) is determined by pitchLen (which is the Duration value from pitchTab[] )
-      for ( uint32_t j=0; j<pitchLen; j++ ) {
-        // send next value to PWM register OCR0A
-        gumWavDat = pgm_read_byte( &( gumballWavTab[gumIndex] ) );
-        OCR0A = gumWavDat;
-        // delay a little
-        delaySomeTime(pitchRate, SAMP);
-        // increment to next value in gumballWavTab[]
-        gumIndex++;
-        // reset the index to the beginning if we reached the end of the table
-        // and also do something interesting to the LEDs on PB2 (red) and PB1 (green)
-        if (gumIndex >= gumballWavTabSize) {
-          gumIndex = 0;  // reset the index to the beginning of gumballWavTab
-          // make the LEDs light up in cool ways -- PB1 (green), PB2 (red), PB3 (blue)
-          if ( ( (pitchRate % 50) == 0 ) || ( (pitchRate % 20) == 0 ) ) {
-            PORTB ^= B8(00000100);  // toggle LED at PB2 (red)
-          }
-          if ( ( (pitchRate % 40) == 0 ) || ( (pitchRate % 10) == 0 ) ) {
-            PORTB ^= B8(00000010);  // toggle LED at PB1 (green)
-          }
-        }
-      }
-      // get the next values of pitchRate and pitchLen from pitchTab[]
-      pitchIndex++;
-      pitchRate = pgm_read_byte( &( pitchTab[pitchIndex].gumballPitch ) );
-      pitchLen = pgm_read_word( &( pitchTab[pitchIndex].pitchDuration ) );
+volatile uint16_t phaseIncFrac;   // how far to step phaseFrac each Timer0 overflow (sets the pitch)
+volatile uint8_t  phaseIncWhole;  //   and how many whole samples to step as well
+volatile uint16_t samplesLeft;  // how many more wave table samples to play for this pitch
+volatile uint8_t  pitchPlaying; // the interrupt sets this to 0 when samplesLeft runs out
+volatile uint8_t  controlTick;  // the interrupt sets this to 1 once every CONTROL_DIV samples
+uint8_t  controlCount = CONTROL_DIV;  // counts samples until the next control tick (only used by the interrupt)
+uint16_t phaseFrac;             // fraction part of the phase accumulator (only used by the interrupt)
+uint8_t  gumIndex;              // index into gumballWavTab[] (only used by the interrupt)
+uint8_t  gumWavDat;             // the sample we are playing from gumballWavTab[] (only used by the interrupt)
+uint8_t  mixOut;                // the next sample to send to OCR0A (only used by the interrupt)
+
+
+
+//--------------------
+// More voices
+//
+// The pitches in pitchTab[] are played by the first voice (above).  There can
+// be 1 or 2 more voices playing along with it, each with its own pitch and its
+// own phase accumulator.  They play the same wave table as the first voice.
+// A CMD(CMD_VOICE2, pitch) command in pitchTab[] sets the pitch of voice 2,
+// which it keeps on playing (under the pitches of the first voice) until the
+// next CMD_VOICE2 command changes it.  CMD(CMD_VOICE2, 0) makes voice 2 quiet.
+// CMD_VOICE3 does the same for voice 3.
+//
+// The ATtiny13a cannot multiply (it has no MUL instruction), so the voices are
+// mixed with only adds and shifts:
+//   VOICES=2:  (voice1 + voice2) / 2
+//   VOICES=3:  (voice1*2 + voice2 + voice3) / 4   (so the first voice is the loudest)
+// A quiet voice plays 0x80 (the middle), so the first voice is always just as loud.
+//
+// The interrupt has to be done in less than 256 clock cycles (one PWM cycle).
+// With VOICES=1 it takes about 120 clock cycles, and each extra voice adds
+// about 35 more.  These (and the figures for the other parts of the interrupt
+// below) are estimates, not yet measured on a real build, and the #error checks
+// that keep the interrupt in time are worked out from them.  "make check" counts
+// the real worst case in GumballSound.lss (with tools/avrbudget.py), and stops
+// if it is over 256, or if the firmware does not fit in the flash -- and
+// "make budgets" does the same for each combination of switches that is
+// allowed, and lists them in budgets.txt.  If a combination is over 256 (or has
+// plenty to spare), change its #error check to match.
+// WAVE_DELTA can only be played by one voice, since it has to play every sample in order.
+#ifndef VOICES
+#define VOICES  1   // how many voices can play at once (1, 2, or 3)
+#endif
+#if VOICES < 1 || VOICES > 3
+  #error "VOICES must be 1, 2, or 3"
+#endif
+#if VOICES > 1 && WAVE_FORMAT == WAVE_DELTA
+  #error "WAVE_DELTA can only be played with VOICES=1"
+#endif
+
+#if VOICES > 1
+struct voiceState {
+  uint16_t phaseFrac;      // fraction part of the phase accumulator
+  uint16_t phaseIncFrac;   // how far to step phaseFrac each Timer0 overflow (0 when the voice is quiet)
+  uint8_t  phaseIncWhole;  //   and how many whole samples to step as well
+  uint8_t  wavIndex;       // index into the wave table
+  uint8_t  wavDat;         // the sample we are playing
+};
+// voices 2 and 3 (main() only changes these with the interrupt turned off)
+struct voiceState voice[VOICES - 1];
+
+
+
+//--------------------
+// The interrupt calls this to step one of the extra voices on to its next sample
+static inline void voiceStep(struct voiceState *v) {
+  uint8_t step = v->phaseIncWhole;
+  v->phaseFrac += v->phaseIncFrac;
+  if (v->phaseFrac < v->phaseIncFrac) {
+    step++;  // phaseFrac carried over
+  }
+  if (step != 0) {
+    uint8_t i = v->wavIndex + step;
+    if (i >= wavSize) {
+      i -= wavSize;
+    }
+    v->wavIndex = i;
+    v->wavDat = wavSample(i);
+  }
+}
+#endif
+
+
+
+//--------------------
+// Noise channel
+//
+// This adds noise to the sound, for hats, snares, and whooshing sweeps.
+// The noise comes from a "linear-feedback shift register" (LFSR): each time
+// it is clocked, lfsr shifts right by one bit, and if the bit that fell out
+// was a 1, some of its bits (the "taps") are flipped.  The bit that falls out
+// looks random, and it takes a long time to repeat:
+//   NOISE_LONG   taps 0xB400 -- repeats every 65535 clocks (a hiss)
+//   NOISE_SHORT  taps 0x0060 -- repeats every 127 clocks (a buzzy, metallic noise)
+// (with the short taps, only the low 7 bits of lfsr are used, so setNoise() throws
+// the top bits away when it switches to them -- otherwise some of the states the
+// long register can be in shift down to 0, and 0 stays 0 for ever, so it would go quiet)
+// The noise plays at full volume (0x00 or 0xFF), like the old chip sound generators.
+//
+// period is how many samples each noise bit lasts (1 to 255): 1 is the
+// brightest hiss, and bigger numbers make it duller and lower.
+// mix is how much noise there is, in quarters (0 to 4):
+//   0 = just the voices, 2 = half voices and half noise, 4 = just noise
+// The mix is done with adds and shifts (no multiply), like the voice mixer.
+// A hit of noise for percussion is just three elements in pitchTab[]:
+//   CMD(CMD_NOISE, NOISE_SET(1, 3, NOISE_LONG)),  NOTE(200, 40),  CMD(CMD_NOISE, 0)
+//
+// The noise channel adds about 30 clock cycles to the interrupt (a few more
+// when the noise is clocked), whether the noise is on or off, and whatever the
+// period and mix are, so it never runs late.  With NOISE=0 (the default) it is
+// left out completely.
+#ifndef NOISE
+#define NOISE   0   // 1 to put in the noise channel
+#endif
 
-      // make the LEDs light up in cool ways -- PB1 (green), PB2 (red), PB3 (blue)
-      PORTB ^= B8(00001000);  // toggle LED at PB3 (blue)
+#if NOISE
+uint16_t lfsr = 1;             // the shift register (it must never be 0)
+uint16_t noiseTaps = 0xB400;   // which bits of lfsr to flip
+uint8_t  noisePeriod = 1;      // how many samples each noise bit lasts
+uint8_t  noiseCount = 1;       // counts samples until the next noise bit (only used by the interrupt)
+uint8_t  noiseMix;             // how much noise to mix in, in quarters (0 is off)
+
+
+
+//--------------------
+// The interrupt calls this to clock the noise, and mix it into the sample
+static inline uint8_t noiseStep(uint8_t out) {
+  uint8_t noise;
+  int16_t diff;
+  uint16_t sum;
+
+  if (--noiseCount == 0) {
+    noiseCount = noisePeriod;
+    uint8_t bit = lfsr & 1;
+    lfsr >>= 1;
+    if (bit) {
+      lfsr ^= noiseTaps;
+    }
+  }
+  noise = (lfsr & 1) ? 0xFF : 0x00;
+
+  // out*(4-mix)/4 + noise*mix/4, which is out + (noise-out)*mix/4
+  diff = (int16_t)noise - out;
+  sum = (uint16_t)out << 2;
+  if (noiseMix & 1) sum += diff;
+  if (noiseMix & 2) sum += diff << 1;
+  if (noiseMix & 4) sum += diff << 2;
+  return sum >> 2;
+}
+#endif
+
+
+
+//--------------------
+// Envelope
+//
+// Without an envelope, each pitch starts and stops suddenly, at full volume.
+// The envelope makes the volume of each pitch rise and fall:
+//   attack   -- how quickly it rises from quiet to full volume at the start of the pitch
+//   decay    -- how quickly it then falls to the sustain volume
+//   sustain  -- the volume it stays at
+//   release  -- how quickly it fades away at the end of the pitch
+// These are set by a CMD(CMD_ENV, ENV_SET(attack, decay, sustain, release))
+// command in pitchTab[], and they stay the same until the next CMD_ENV.
+// Each one is a number from 0 to 15:
+//   attack, decay, release:  0 is straight away (or for release, no fading at all),
+//                            1 is about 6ms, and each one after that is about
+//                            1.4 times slower, up to 15 (about 1 second)
+//   sustain:                 0 is full volume, and each one after that is 3dB quieter
+// The release starts when the last quarter of the pitch begins (there is no
+// "key up" in pitchTab[], so this is as near as we can get).
+//
+// The volume is kept as a "level": 0 is full volume, and each level is 1.5dB
+// quieter than the one before (so it fades smoothly to our ears, which hear
+// loudness that way).  envGainTab[] turns the level into a gain that we can
+// multiply the samples by: 255 is full volume, 128 is half, and 0 is quiet.
+// The level only changes at the control rate (in main()), so the interrupt
+// just has to do the multiply.  The ATtiny13a has no MUL instruction, so the
+// multiply is done with 8 shifts and adds.  It scales everything the interrupt
+// plays (the voices and the noise).
+//
+// The envelope adds about 80 clock cycles to the interrupt, and it takes the
+// same number every time.  The interrupt only has 256, so it cannot be used
+// with both an extra voice and the noise channel.  With ENVELOPE=0 (the
+// default) it is left out completely.
+#ifndef ENVELOPE
+#define ENVELOPE   0   // 1 to put in the envelope
+#endif
+#if ENVELOPE && (VOICES - 1 + NOISE) > 1
+  #error "the interrupt is too slow with ENVELOPE, NOISE, and VOICES=2 (or with ENVELOPE and VOICES=3)"
+#endif
+
+#if ENVELOPE
+// the gain for each level (1.5dB apart) -- the last level is quiet
+const uint8_t envGainTab[] PROGMEM = {
+  255, 215, 181, 152, 128, 108,  90,  76,  64,  54,  45,  38,  32,  27,  23,  19,
+   16,  14,  11,  10,   8,   7,   6,   5,   4,   3,   3,   2,   2,   2,   1,   0
+};
+// how far the level moves each control tick (in 1/8ths of a level) for attack, decay, and release 0 to 15
+const uint8_t envRateTab[] PROGMEM = {
+  248, 176, 124,  88,  62,  44,  31,  22,  16,  11,   8,   6,   4,   3,   2,   1
+};
+#define ENV_SILENT  248   // envLevel when it is quiet (level 31, in 1/8ths)
+
+#define ENV_ATTACK   0
+#define ENV_DECAY    1
+#define ENV_SUSTAIN  2
+#define ENV_RELEASE  3
+
+uint16_t envShape;       // the value from the last CMD_ENV command (made by ENV_SET)
+uint8_t  envStage;       // which part of the envelope we are in (ENV_ATTACK, etc.)
+uint8_t  envLevel;       // the level, in 1/8ths (so it can move slowly) -- 0 is full volume
+uint16_t envReleaseAt;   // start the release when samplesLeft gets down to this
+volatile uint8_t envGain = 255;  // the gain the interrupt multiplies by (from envGainTab[])
+
+
+
+//--------------------
+// The interrupt calls this to multiply a sample by envGain
+// The sample is made signed first, so it gets quieter towards the middle (0x80).
+// The answer is 256 times too big (envScale() divides it by 256, and DITHER keeps the fraction).
+static inline int16_t envMul(uint8_t out) {
+  int16_t x = (int8_t)(out - 0x80);
+  int16_t sum = 0;
+  uint8_t gain = envGain;
+
+  // add up x*1, x*2, x*4, ... for each bit of gain that is 1
+  for (uint8_t b=0; b<8; b++) {
+    if (gain & 1) {
+      sum += x;
     }
+    x <<= 1;
+    gain >>= 1;
+  }
+  return sum;
+}
+
+
+
+//--------------------
+// The interrupt calls this to multiply a sample by envGain (and divide by 256)
+static inline uint8_t envScale(uint8_t out) {
+  return 0x80 + (envMul(out) >> 8);
+}
+#endif
+
+
+
+//--------------------
+// Plucked strings
+//
+// This plays pitches that sound like a plucked string (a guitar or a harp),
+// using the "Karplus-Strong" trick.  It needs no wave table in flash -- just
+// a short "delay line" in RAM, ksBuf[].  At the start of each pitch we fill
+// ksBuf[] with a burst of noise (or with the wave table), which is the pluck.
+// Then the first voice plays ksBuf[] round and round, just like it plays a
+// wave table, with the same phase accumulator (so the pitch is set by how many
+// samples there are in ksBuf[], and the fraction of a sample we step each time).
+// Each time it plays a sample, it puts back the average of that sample and the
+// next one.  This smooths the sound a little more each time round, so the high
+// sounds die away first, and then it all fades away to nothing, like a string.
+// (Higher pitches go round more often, so they die away faster, like a real string.)
+//
+// CMD(CMD_PLUCK, PLUCK_NOISE) plays the pitches after this as plucked strings,
+// CMD(CMD_PLUCK, PLUCK_WAVE) does the same but plucks them with the wave table
+// (so they start with its sound), and CMD(CMD_PLUCK, PLUCK_OFF) goes back to
+// playing the wave table.  ksBuf[] is shorter than gumballWavTab[], so a plucked
+// pitch sounds higher than the same gumballPitch played with gumballWavTab[]
+// (92 / KS_SIZE times higher).
+//
+// The ATtiny13a only has 64 bytes of RAM, and the stack has to fit in what the
+// variables leave (it grows down from the top of RAM, and the interrupt pushes
+// all the registers it uses onto it, on top of whatever main() has there).
+// ksBuf[] is the biggest variable there is, and KS_SIZE=16 has not been checked
+// on a real build yet, so build with KARPLUS=1 and run "make check" before
+// using it: it works out how much stack the firmware needs, from
+// GumballSound.lss and GumballSound.su (see "ramcheck" in the Makefile), and
+// stops if the variables do not leave that much.  If it stops, make KS_SIZE
+// smaller (or leave out NOISE, ENVELOPE, or the extra VOICES).
+//
+// Plucking adds about 25 clock cycles to the interrupt, when it steps to the
+// next sample.  With KARPLUS=0 (the default) it is left out completely.
+#ifndef KARPLUS
+#define KARPLUS   0   // 1 to put in plucked strings
+#endif
+#ifndef KS_SIZE
+#define KS_SIZE   16  // how many bytes of RAM ksBuf[] uses (8 to 32)
+#endif
+#if KS_SIZE < 8 || KS_SIZE > 32
+  #error "KS_SIZE must be between 8 and 32"
+#endif
+#if KARPLUS && WAVE_FORMAT == WAVE_DELTA
+  #error "KARPLUS cannot be used with WAVE_DELTA"
+#endif
+
+#if KARPLUS
+uint8_t ksBuf[KS_SIZE];       // the delay line (the string)
+uint8_t ksMode;               // PLUCK_OFF, PLUCK_NOISE, or PLUCK_WAVE
+uint8_t ksSeed = 1;           // makes the noise for plucking (it must never be 0)
+
+
+
+//--------------------
+// The interrupt calls this to step the first voice through ksBuf[] (instead of the wave table)
+static inline uint8_t ksStep(uint8_t step) {
+  uint8_t i, next, a, b;
+  int16_t s;
+
+  i = gumIndex + step;
+  if (i >= KS_SIZE) {
+    i -= KS_SIZE;
+    ledWrapped();
+  }
+  gumIndex = i;
+  next = i + 1;
+  if (next >= KS_SIZE) {
+    next = 0;
+  }
+  // the average of this sample and the next one, worked out as signed samples
+  // (-128 to 127 round 0x80), and rounded towards 0 -- if it was always rounded
+  // down, the string would fade away to a DC level below 0x80 instead of to
+  // silence, and the next note would start with a click
+  // (when the two samples are the same, it moves 1 closer to 0 as well, so a
+  // string that has stopped moving away from 0x80 still creeps back to it)
+  a = ksBuf[i];
+  b = ksBuf[next];
+  s = (int8_t)(a - 0x80) + (int8_t)(b - 0x80);
+  if (s < 0) {
+    s += (a == b) ? 2 : 1;
+  } else if (s > 0 && a == b) {
+    s--;
+  }
+  ksBuf[i] = (uint8_t)(s >> 1) + 0x80;
+  return ksBuf[i];
+}
+#endif
+
+
+
+//--------------------
+// Bytebeat
+//
+// A "bytebeat" is a formula that makes a sample out of a time counter, t,
+// using shifts, ANDs, ORs, XORs, and so on (like  t & t>>8 ).  Played at
+// about 8000 samples a second, a formula of a few steps makes minutes of
+// strange, ever-changing music.
+//
+// A CMD(CMD_BEAT, n) command in pitchTab[] plays the pitches after it with
+// formula n in beatBank[] instead of the wave table, until CMD(CMD_BEAT, 0).
+// The pitches still play for their durations as usual, and t counts along
+// with the first voice's phase accumulator, 16 counts for each wave table
+// sample.  So the pitch sets how fast t counts (gumballPitch 100 is about
+// 9300 counts a second at any F_CPU), and the same formula can be played
+// higher and lower.
+//
+// The formulas are kept in PROGMEM as a few bytes of "bytecode".  Each byte
+// is one step: the high 4 bits say what to do, and the low 4 bits are a number
+// (n) for it to use.  The steps work on a 16-bit value, acc, and the sample is
+// the low 8 bits of acc at the end.  There is also one more value, x, to keep
+// a part of the formula in while we work out the next part:
+//   BB_T(n)     acc = t >> n
+//   BB_OR(n)    acc |= t >> n
+//   BB_AND(n)   acc &= t >> n
+//   BB_XOR(n)   acc ^= t >> n
+//   BB_ADD(n)   acc += t >> n
+//   BB_SUB(n)   acc -= t >> n
+//   BB_SHR(n)   acc >>= n
+//   BB_SHL(n)   acc <<= n
+//   BB_MUL(n)   acc *= n            (n is 0 to 15 -- this is done with shifts and adds)
+//   BB_MASK(n)  acc &= (1 << n) - 1 (keeps the low n bits)
+//   BB_SAVE     x = acc
+//   BB_OR_X     acc |= x
+//   BB_AND_X    acc &= x
+//   BB_XOR_X    acc ^= x
+//   BB_ADD_X    acc += x
+//   BB_END      the end of the formula
+//
+// The formula is worked out by main(), not the interrupt: main() wakes up
+// after every sample, and works out a new one whenever t has moved on (every
+// 4 samples or so at 9.6MHz, which leaves time for a formula of about 10
+// steps).  The interrupt just plays the last one main() worked out, so a
+// long formula (or a slow F_CPU) only makes the sound a bit rougher -- it never
+// makes the interrupt late.  The interrupt only spends about 10 clock cycles
+// counting t.  With BYTEBEAT=0 (the default) it is left out completely.
+#ifndef BYTEBEAT
+#define BYTEBEAT   0   // 1 to put in the bytebeat formulas
+#endif
+#if BYTEBEAT && WAVE_FORMAT == WAVE_DELTA
+  #error "BYTEBEAT cannot be used with WAVE_DELTA"
+#endif
+
+#define BB_END       0x00
+#define BB_T(n)      (0x10 | (n))
+#define BB_OR(n)     (0x20 | (n))
+#define BB_AND(n)    (0x30 | (n))
+#define BB_XOR(n)    (0x40 | (n))
+#define BB_ADD(n)    (0x50 | (n))
+#define BB_SUB(n)    (0x60 | (n))
+#define BB_SHR(n)    (0x70 | (n))
+#define BB_SHL(n)    (0x80 | (n))
+#define BB_MUL(n)    (0x90 | (n))
+#define BB_MASK(n)   (0xA0 | (n))
+#define BB_SAVE      0xB0
+#define BB_OR_X      0xC0
+#define BB_AND_X     0xD0
+#define BB_XOR_X     0xE0
+#define BB_ADD_X     0xF0
+
+#if BYTEBEAT
+// t & t>>8
+const uint8_t beatSierpinski[] PROGMEM = {
+  BB_T(0), BB_AND(8), BB_END
+};
+// t*5 & t>>7  |  t*3 & t>>10
+const uint8_t beatMelody[] PROGMEM = {
+  BB_T(0), BB_MUL(5), BB_AND(7), BB_SAVE,
+  BB_T(0), BB_MUL(3), BB_AND(10), BB_OR_X, BB_END
+};
+// t*9 & t>>4  |  t*5 & t>>7  |  t*3 & t>>10
+const uint8_t beatChords[] PROGMEM = {
+  BB_T(0), BB_MUL(9), BB_AND(4), BB_SAVE,
+  BB_T(0), BB_MUL(5), BB_AND(7), BB_OR_X, BB_SAVE,
+  BB_T(0), BB_MUL(3), BB_AND(10), BB_OR_X, BB_END
+};
+
+// all of the formulas that CMD(CMD_BEAT, n) can play (n=1 is the first one)
+const uint8_t * const beatBank[] PROGMEM = {
+  beatSierpinski,
+  beatMelody,
+  beatChords
+};
+#define BEAT_COUNT  ( sizeof(beatBank) / sizeof(beatBank[0]) )
+
+const uint8_t *beatCode;   // the formula we are playing (only used by main())
+uint16_t beatT;            // t, the last time we worked out the formula (only used by main())
+volatile uint16_t beatSteps;  // the interrupt adds up how many samples the first voice has stepped
+volatile uint8_t beatOn;   // 1 when we are playing a formula (instead of the wave table)
+volatile uint8_t beatOut;  // the sample main() worked out from the formula, for the interrupt to play
+#endif
+
+
+
+//--------------------
+// Phase modulation
+//
+// This changes the sound of the wave table while it plays, without storing
+// any more waveforms.  A second phase accumulator (the "modulator") plays
+// sineWavTab[], and instead of listening to it, we add it to the place we
+// play from in the wave table (the "carrier").  So the first voice wobbles
+// backwards and forwards in the wave table as it goes along, which adds lots
+// of new harmonics to the sound.  (This is how the famous "FM" synthesizers work.)
+//
+// A CMD(CMD_FM, FM_SET(ratio, depth)) command in pitchTab[] sets it for the pitches after it:
+//   ratio  -- how fast the modulator goes round sineWavTab[], compared to how fast
+//             the first voice goes round its wave table, in halves (1 to 15):
+//             2 is the same speed, 4 is twice as fast, 3 is 1.5 times as fast.
+//             (whole numbers of the same speed sound musical, others sound like bells)
+//   depth  -- how far the modulator moves the place we play from (1 to 8):
+//             the sine wave is shifted right by 8-depth, so each one is twice as
+//             far as the one before it (8 is as far as 128 samples).  0 turns it off.
+// The ATtiny13a has no MUL instruction, so the depth is done with shifts, and
+// the modulator's speed is worked out with adds (by main(), once for each pitch).
+// The place we play from is never moved by more than the wave table is long,
+// so it only has to be wrapped round once (for short wave tables the depth is
+// made smaller until it fits).
+//
+// Phase modulation adds about 65 clock cycles to the interrupt (a few less
+// for smaller depths).  That is too many to use it with the envelope, or with
+// both an extra voice and the noise.  It plays the wave table, so it does not
+// change bytebeats, and it waits while plucked strings are playing (fmOn is 0
+// then, so the pluck is not played from the wave table by mistake).
+// With FM=0 (the default) it is left out completely.
+#ifndef FM
+#define FM   0   // 1 to put in phase modulation
+#endif
+#if FM && WAVE_FORMAT == WAVE_DELTA
+  #error "FM cannot be used with WAVE_DELTA"
+#endif
+#if FM && (ENVELOPE || (VOICES - 1 + NOISE) > 1)
+  #error "the interrupt is too slow with FM and ENVELOPE (or FM, NOISE, and VOICES=2, or FM and VOICES=3)"
+#endif
+
+#if FM
+#if WAVE_FORMAT == WAVE_RAW
+  #define FM_SINE  sineWavTab
+#elif WAVE_FORMAT == WAVE_PACK4
+  #define FM_SINE  sineWavTab4
+#else
+  #define FM_SINE  sineWavTabHalf
+#endif
+#define FM_SINE_SIZE  32   // how many samples sineWavTab[] has (this has to be a power of 2)
+
+uint16_t fmShape;          // the value from the last CMD_FM command (made by FM_SET)
+uint16_t fmFrac;           // fraction part of the modulator's phase accumulator (only used by the interrupt)
+uint8_t  fmIndex;          // index into sineWavTab[] (only used by the interrupt)
+uint16_t fmIncFrac;        // how far to step fmFrac each Timer0 overflow
+uint8_t  fmIncWhole;       //   and how many whole samples to step as well
+uint8_t  fmShift;          // how far to shift the sine wave right (8-depth, or more for short wave tables)
+volatile uint8_t fmOn;     // 1 when phase modulation is on
+
+
+
+//--------------------
+// This function works out fmOn: it needs a ratio and a depth, and it is off
+// while plucked strings are playing (the interrupt must not run while we change it)
+static inline void fmSetOn(void) {
+  fmOn = (fmShape & 0x0F) != 0 && (fmShape & 0xF0) != 0
+#if KARPLUS
+         && ksMode == PLUCK_OFF
+#endif
+         ;
+}
+
+
+
+//--------------------
+// This function works out fmShift from the depth, so that the sine wave never
+// moves us more than the length of the wave table (so one wrap is always enough)
+// (the interrupt must not run while we change it)
+static inline void fmSetShift(void) {
+  uint8_t depth = (fmShape >> 4) & 0x0F;
+  uint8_t shift;
+
+  if (depth > 8) {
+    depth = 8;
+  }
+  shift = 8 - depth;
+  while ((128 >> shift) > wavSize) {
+    shift++;
+  }
+  fmShift = shift;
+}
+
+
+
+//--------------------
+// The interrupt calls this to step the modulator, and play the wave table from where it says
+static inline uint8_t fmStep(void) {
+  uint8_t step = fmIncWhole;
+  int8_t mod;
+  int16_t i;
+
+  fmFrac += fmIncFrac;
+  if (fmFrac < fmIncFrac) {
+    step++;  // fmFrac carried over
+  }
+  fmIndex = (fmIndex + step) & (FM_SINE_SIZE - 1);
+  mod = (int8_t)(wavRead(FM_SINE, FM_SINE_SIZE, fmIndex) - 0x80);
+  i = gumIndex + (mod >> fmShift);
+  if (i < 0) {
+    i += wavSize;
+  } else if (i >= wavSize) {
+    i -= wavSize;
+  }
+  return wavSample(i);
+}
+#endif
+
+
+
+//--------------------
+// Wave table window
+//
+// This plays just part of the wave table (a "window" onto it), so one wave
+// table can make lots of different sounds.  A short window from a bumpy part
+// of gumballWavTab[] sounds quite different from a long one from a smooth part.
+// A CMD(CMD_WINDOW, WINDOW_SET(start, length, drift)) command in pitchTab[] sets
+// the window for the pitches after it:
+//   start   -- the first sample of the window (0 to 127)
+//   length  -- how many samples the window has (4 to 126, in steps of 2), or 0 for the whole wave table
+//              (a shorter window sounds higher, just like a shorter wave table)
+//   drift   -- how fast the window slides along the wave table (0 to 7):
+//              0 stays still, 1 moves one sample every 64 control ticks (about 4 times
+//              a second), and each one after that is twice as fast, up to 7 (every control tick)
+// The window goes round past the end of the wave table to the beginning again.
+// A CMD_TIMBRE command goes back to the whole of the new wave table.
+//
+// The first voice counts gumIndex through the window (from 0 to winSize-1),
+// and adds winStart to it to find the sample.  Each of these only has to wrap
+// round once (with one compare), so it takes the same time wherever the
+// window is: about 8 more clock cycles in the interrupt.  Phase modulation
+// and the extra voices still play the whole wave table.
+// With WINDOW=0 (the default) it is left out completely.
+#ifndef WINDOW
+#define WINDOW   0   // 1 to put in wave table windows
+#endif
+#if WINDOW && WAVE_FORMAT == WAVE_DELTA
+  #error "WINDOW cannot be used with WAVE_DELTA"
+#endif
+
+#if WINDOW
+volatile uint8_t winStart;   // the first sample of the window
+volatile uint8_t winSize;    // how many samples the window has
+uint8_t winDriftEvery;       // how many control ticks between each move of the window (0 for none)
+uint8_t winDriftCount;       // counts control ticks to the next move (only used by main())
+
+
+
+//--------------------
+// The interrupt calls this to find where sample i of the window is in the wave table
+static inline uint8_t winIndex(uint8_t i) {
+  i += winStart;
+  if (i >= wavSize) {
+    i -= wavSize;
+  }
+  return i;
+}
+#endif
+
+
+
+//--------------------
+// Interpolation
+//
+// A low pitch steps through the wave table slowly, so each sample is played
+// over and over (for gumballPitch 200 at 9.6MHz, 129 times) before the next
+// one, and the waveform comes out as a staircase.  The sharp edges of the
+// stairs add a buzz of high "image" frequencies that are not in the sound.
+// With INTERP=1 the first voice slides from each sample to the next, using
+// the fraction part of the phase accumulator (phaseFrac) to say how far it
+// has got: it plays  left + (right - left) * frac  where frac is the top 4
+// bits of phaseFrac (in 1/16ths).  There is no multiply instruction, so
+// wavBlend() does the multiply with 4 shifts and adds.
+// Only pitches of INTERP_PITCH and lower (a gumballPitch of INTERP_PITCH or
+// more) are interpolated -- playPitch() decides for each pitch.  High pitches
+// hardly have any stairs to smooth, so they are played as usual, and do not
+// pay for it.  Plucked strings, phase modulation, and bytebeat are not
+// interpolated either.
+// This takes about 45 more clock cycles in the interrupt for each sample,
+// and about 15 more each time it steps to the next sample (to read the
+// sample after it), and 3 bytes of RAM.
+// With INTERP=0 (the default) it is left out completely.
+#ifndef INTERP
+#define INTERP        0   // 1 to interpolate low pitches
+#endif
+#ifndef INTERP_PITCH
+#define INTERP_PITCH 40   // interpolate gumballPitch values of this or more
+#endif
+#if INTERP && WAVE_FORMAT == WAVE_DELTA
+  #error "INTERP cannot be used with WAVE_DELTA"
+#endif
+#if INTERP && (ENVELOPE || (VOICES - 1 + NOISE) > 1)
+  #error "the interrupt is too slow with INTERP and ENVELOPE (or INTERP, NOISE, and VOICES=2, or INTERP and VOICES=3)"
+#endif
+
+#if INTERP
+uint8_t interpOn;    // 1 to interpolate the pitch that is playing -- set by playPitch()
+uint8_t gumLeft;     // the sample we are sliding from (only used by the interrupt)
+uint8_t gumRight;    // the sample we are sliding to (only used by the interrupt)
+
+
+
+//--------------------
+// The interrupt calls this to slide from "left" to "right" (frac is how far, in 1/256ths)
+static inline uint8_t wavBlend(uint8_t left, uint8_t right, uint8_t frac) {
+  int16_t diff = (int16_t)right - left;
+  int16_t sum = 0;
+
+  // sum = diff * (frac >> 4), one bit at a time
+  if (frac & 0x10) sum += diff;
+  diff <<= 1;
+  if (frac & 0x20) sum += diff;
+  diff <<= 1;
+  if (frac & 0x40) sum += diff;
+  diff <<= 1;
+  if (frac & 0x80) sum += diff;
+  return left + (sum >> 4);
+}
+#endif
+
+
+
+//--------------------
+// Glide
+//
+// A GLIDE(from, to, ticks) in pitchTab[] slides smoothly from one pitch to
+// another, instead of stepping there one NOTE() at a time (a "portamento").
+// It starts like a NOTE() at pitch "from", and then every control tick
+// glideUpdate() moves the pitch a little nearer to "to", and works out a new
+// phase step for the interrupt.  The pitch is kept as a fixed-point number
+// (8 bits of whole gumballPitch, and 8 bits of fraction), so even a slow
+// glide moves a little every tick, and it sounds smooth, not stepped.
+// The glide lasts "ticks" control ticks (there are CONTROL_RATE each second),
+// so its length does not depend on the pitch, the way a NOTE()'s does.
+//
+// The interrupt does not have to do anything more -- it just plays the phase
+// step it is given.  glideUpdate() does a divide each tick, which takes
+// main() about 600 clock cycles (but main() has lots of time while it waits).
+// Phase modulation keeps the speed it had at the start of the glide, and the
+// envelope does not release until the glide is over.
+// With PORTAMENTO=0 (the default) it is left out completely (and a GLIDE() in
+// pitchTab[] is taken as the END).
+#ifndef PORTAMENTO
+#define PORTAMENTO   0   // 1 to put in glides
+#endif
+
+#if PORTAMENTO
+uint8_t  glideTo;       // the pitch the next GLIDE() goes to (0 if it is a NOTE()) -- set by vmNext()
+uint16_t glidePitch;    // the pitch we are at, in 1/256ths of a gumballPitch
+int16_t  glideStep;     // how much to add to glidePitch each control tick
+uint16_t glideTicks;    // how many more control ticks the glide lasts (0 when we are not gliding)
+#endif
+
+
+
+//--------------------
+// Note timing
+//
+// Usually the pitchDuration of a NOTE() counts wave table samples, so a low
+// pitch (which steps through the samples slowly) plays for longer than a
+// high one with the same pitchDuration.  That gives the composition its
+// sound, but it makes it hard to write music in beats.
+// With NOTE_TIME=1 the pitchDuration counts "score ticks" instead, and there
+// are TICKS_PER_BEAT of them in each beat, whatever the pitch is.  The score
+// ticks come from the control ticks (which come from counting samples in the
+// interrupt, so they keep time as well as the internal RC oscillator does --
+// to within a few percent -- and do not slow down when the interrupt has more
+// to do):  each control tick noteUpdate() adds
+// tempoStep to tempoCount, and each time that goes round past 65536 it is a
+// score tick.  So the tempo comes out exactly right in the long run, and a
+// note starts and ends on a control tick (to within 1/CONTROL_RATE second).
+// The composition starts at TEMPO_BPM beats a minute, and a TEMPO(bpm) in
+// pitchTab[] changes it from the next NOTE() on.  (The tempo can go up to
+// about 600 beats a minute, which is when there is a score tick for every
+// control tick.)  So with 24 ticks a beat, NOTE(100, 24) is a crotchet
+// (a quarter note), NOTE(100, 6) is a semiquaver (a sixteenth note), and
+// NOTE(100, 8) is a quaver triplet.
+// A GLIDE() still counts control ticks, and the envelope releases in the
+// last quarter of the note, as usual.
+// This costs main() about 20 clock cycles each control tick (the interrupt
+// does nothing more), and 8 bytes of RAM.
+// With NOTE_TIME=0 (the default) it is left out completely (and a TEMPO()
+// in pitchTab[] is taken as the END).
+//
+// The lengths in score.txt count samples, so with NOTE_TIME=1 they would be
+// taken as ticks, and the composition would last about 6 minutes.  So
+// pitchTab[] says which units it has (PITCH_TAB_TICKS), and this will not
+// compile if that does not match NOTE_TIME.  To play score.txt with
+// NOTE_TIME=1, run
+//   python3 tools/scoreasm.py --to-ticks 600 score.txt
+// and paste what it prints over pitchTab[] (and PITCH_TAB_TICKS).  It works
+// out how long each note plays for, and turns that into score ticks (at 600
+// beats a minute here, where a tick is 1/240 second -- at the starting tempo
+// of 120 a tick is 1/48 second, which is longer than the shortest notes).
+// A score written in ticks to begin with is made with --ticks instead.
+#ifndef NOTE_TIME
+#define NOTE_TIME       0    // 1 to count NOTE() lengths in score ticks
+#endif
+#if NOTE_TIME
+uint16_t noteTicks;     // how many more score ticks this NOTE() lasts (0 when it is a GLIDE())
+uint16_t tempoCount;    // counts up by tempoStep each control tick, and each time it goes round it is a score tick
+uint16_t tempoStep;     // the tempo, made by TEMPO_STEP() (see CONTROL_DIV)
+uint16_t tempoNext;     // the tempo from the next NOTE() on -- set by vmNext() when it finds a TEMPO()
+#endif
+
+
+
+//--------------------
+// Vibrato
+//
+// A VIBRATO(depth, rate) in pitchTab[] makes the pitch of the NOTE()s after it
+// wobble up and down, with a slow "LFO" (low frequency oscillator), instead
+// of staying at one pitch for the whole note:
+//   depth  -- how far the pitch goes up and down (0 to 15): each one is about
+//             13 cents (1/8 of a semitone) each way, so 8 is about a semitone,
+//             and 15 is nearly 2 semitones (0 is no vibrato)
+//   rate   -- how fast it goes up and down (0 to 15): rate/2 times a second,
+//             so 11 is 5.5 times a second (a singer's vibrato), and 1 is a
+//             slow wobble
+// It stays the same for all the NOTE()s (and GLIDE()s) after it, until the
+// next VIBRATO().  Each NOTE() starts at its own pitch, and goes up first.
+//
+// The LFO is a triangle wave, made by counting a phase up (by rate each control
+// tick) and folding the top half back down, so it does not need a table.
+// vibUpdate() works out  phase step * (1 + triangle * depth / 8192)  for the
+// interrupt each control tick (there are CONTROL_RATE a second), with shifts
+// and adds for the multiply, so it is smooth to our ears, and the interrupt
+// does not have to do anything more.  It takes main() about 400 clock cycles
+// each control tick, and 8 bytes of RAM.
+// (The length of a NOTE() is counted in samples, so the vibrato can make it a
+// little longer or shorter, if it stops part way through a wobble.)
+// With LFO=0 (the default) it is left out completely (and a VIBRATO() in
+// pitchTab[] is taken as the END).
+#ifndef LFO
+#define LFO   0   // 1 to put in vibrato
+#endif
+
+// how much the LFO phase moves each control tick for each step of rate (half a cycle a second)
+#define VIB_STEP  (uint16_t)( (32768ULL * CONTROL_DIV) / SAMPLE_RATE )
+
+#if LFO
+uint8_t  vibNext;       // the VIBRATO() for the next NOTE() on (depth in the top 4 bits, rate in the bottom 4) -- set by vmNext()
+uint8_t  vibShape;      // the VIBRATO() for this NOTE()
+uint16_t vibPhase;      // where the LFO is in its cycle (the whole cycle is 65536)
+uint32_t vibBase;       // the phase step for the pitch, without the vibrato -- set by playPitch() and glideUpdate()
+#endif
+
+
+
+//--------------------
+// Arpeggio
+//
+// We only have one voice to play a tune with (or not many more, see VOICES),
+// so we cannot play a chord.  But if the voice jumps quickly round the notes
+// of the chord, over and over, our ears hear the chord anyway -- this is the
+// "arpeggio" that the old home computer and game console tunes were full of.
+// A CMD(CMD_ARP, ARP_SET(note1, note2, note3, speed)) command in pitchTab[]
+// plays the pitches after it as arpeggios:
+//   note1, note2, note3  -- the other notes of the chord: how many semitones
+//            (1 to 15) above the pitch each one is.  The arpeggio plays the
+//            pitch, then note1, note2, and note3, and starts over.  A 0 ends
+//            the chord early, so ARP_SET(4, 7, 0, speed) is a major chord
+//            (3 notes), ARP_SET(3, 7, 0, speed) is a minor chord, and
+//            ARP_SET(12, 0, 0, speed) just jumps up an octave and back.
+//   speed  -- how many control ticks each note of the chord lasts (1 to 15,
+//            0 is the same as 1): there are CONTROL_RATE control ticks a
+//            second, so 4 is about 60 notes a second, which is a buzzy chord,
+//            and 15 is slow enough to hear each note
+// It stays the same for all the NOTE()s (and GLIDE()s) after it, until the
+// next CMD_ARP.  Each NOTE() starts its chord over from the pitch.
+// So a whole chord is just one NOTE(), instead of a NOTE() for each step of
+// the arpeggio (which would not fit in pitchTab[]).
+//
+// arpUpdate() works out the phase step of each note of the chord from the
+// phase step of the pitch, each control tick: it multiplies it by
+// 2^(semitones/12), using arpRatioTab[] for the part of an octave (with
+// shifts and adds), and a shift for the octave.  So the chord is in tune with
+// itself, whatever the pitch is, and the interrupt does not have to do
+// anything more.  It takes main() about 300 clock cycles each control tick,
+// and 8 bytes of RAM.  It works with vibrato (the chord wobbles) and with a
+// GLIDE() (the chord slides).
+// (The length of a NOTE() is counted in samples, and the higher notes of the
+// chord play them faster, so an arpeggio makes the NOTE()s shorter -- with
+// NOTE_TIME=1 they are counted in score ticks instead, and stay the same.
+// With MIPMAP, the notes above the pitch are played from the same level as
+// the pitch, so they can alias a little.)
+// With ARPEGGIO=0 (the default) it is left out completely (and a CMD_ARP is
+// ignored).
+#ifndef ARPEGGIO
+#define ARPEGGIO   0   // 1 to put in arpeggios
+#endif
+
+#if ARPEGGIO
+uint16_t arpShape;      // the ARP_SET() for the NOTE()s after it (0 for none)
+uint8_t  arpStep;       // which note of the chord we are playing (0 is the pitch itself)
+uint8_t  arpCount;      // counts control ticks to the next note of the chord
+uint32_t arpBase;       // the phase step for the pitch -- set by playPitch() and glideUpdate()
+
+// how much higher each semitone of an octave is: (2^(semitones/12) - 1) * 4096
+const uint16_t arpRatioTab[12] PROGMEM = {
+  0, 244, 502, 775, 1065, 1372, 1697, 2041, 2406, 2793, 3202, 3636
+};
+#endif
+
 
+
+//--------------------
+// Dither
+//
+// OCR0A only has 8 bits, so every sample has to be rounded to one of 256
+// steps.  Usually the bits that are rounded off are just lost -- when the
+// envelope makes the sound quiet, there are only a few steps left to play it
+// with, and it gets grainy.  Mixing voices loses a bit or two as well.
+// With DITHER the interrupt keeps the mix with 8 more bits of fraction (as a
+// 16-bit number: the top byte is the 8-bit sample, and the bottom byte is
+// how much more there is), and the envelope keeps all 16 bits of its multiply.
+// Then, instead of throwing the fraction away, ditherStep() remembers how much
+// each sample was rounded off by, and takes it into account in the next
+// sample ("error feedback").  The rounding error does not go away, but it is
+// pushed up to high frequencies: the samples come out at 37.5kHz (at 9.6MHz),
+// so a lot of it is above what we can hear, and what is left at the low
+// frequencies is much quieter.  That lets the 8-bit PWM play the detail of
+// 10 to 12 bits at the low frequencies.
+//   DITHER=1 -- first order: the error from the last sample is added on.
+//               Rounding noise at 1kHz is about 15dB quieter (but at 5kHz it is
+//               about the same, and at the top it is twice as loud).
+//               About 10 more clock cycles in the interrupt, and 1 byte of RAM.
+//   DITHER=2 -- second order: twice the last error, less the one before it.
+//               Rounding noise at 1kHz is about 30dB quieter (at 5kHz 4dB
+//               quieter, and at the top 4 times louder).
+//               About 35 more clock cycles in the interrupt, and 2 bytes of RAM.
+// The noise channel and the extra voices are mixed with 8 bits as usual, and
+// with VOICES=1 and no envelope there is no fraction to keep, so it plays
+// just the same as without DITHER (except that DITHER=2 stays a step or two
+// away from the very top and bottom, to leave room for the error).  It needs a high sample rate to have
+// somewhere to push the noise to, so it is no use at 1.2MHz (4.7kHz samples).
+// With DITHER=0 (the default) it is left out completely.
+#ifndef DITHER
+#define DITHER   0   // 1 or 2 to dither the output to more than 8 bits
+#endif
+#if DITHER < 0 || DITHER > 2
+  #error "DITHER must be 0, 1, or 2"
+#endif
+#if DITHER == 2 && (ENVELOPE || FM || INTERP) && (VOICES - 1 + NOISE) > 0
+  #error "the interrupt is too slow with DITHER=2, one of ENVELOPE, FM, or INTERP, and NOISE or VOICES=2"
+#endif
+
+#if DITHER == 1
+uint8_t ditherErr;     // the fraction that was rounded off the last sample (only used by the interrupt)
+#elif DITHER == 2
+int8_t  ditherErr1;    // how much the last sample was rounded by, in 1/256ths (only used by the interrupt)
+int8_t  ditherErr2;    // how much the sample before that was rounded by
+#endif
+
+
+
+#if DITHER
+//--------------------
+// The interrupt calls this to round the mix (8 bits of sample, and 8 bits of
+// fraction) to the 8-bit sample to send to OCR0A
+static inline uint8_t ditherStep(uint16_t fine) {
+#if DITHER == 1
+  // (this can not go past 0xFFFF, since fine is never more than 0xFF00)
+  fine += ditherErr;
+  ditherErr = (uint8_t)fine;
+  return fine >> 8;
+#else
+  int16_t x = (int16_t)(fine - 0x8000);   // make it signed, around the middle
+  int16_t u;
+  int8_t  y;
+
+  // keep away from the very top and bottom, so the error feedback can not go past them
+  if (x > 0x7DFF) x = 0x7DFF;
+  if (x < -0x7E00) x = -0x7E00;
+  u = x + ((int16_t)ditherErr1 << 1) - ditherErr2;
+  y = (u + 0x80) >> 8;            // round to the nearest step
+  ditherErr2 = ditherErr1;
+  ditherErr1 = u - ((int16_t)y << 8);
+  return 0x80 + y;
+#endif
+}
+#endif
+
+
+
+//--------------------
+// Timer0 Overflow interrupt -- this happens every 256 clock cycles
+// It takes the same number of clock cycles every time (except for a few
+// cycles when we step to the next sample), and it always updates OCR0A first,
+// so the samples come out at an exact, steady rate.
+ISR(TIM0_OVF_vect) {
+  uint8_t leds;
+
+  // send the sample we got ready last time to the PWM register OCR0A
+  // (OCR0A is double-buffered in Fast PWM mode, so it takes effect at the start of the next PWM cycle)
+  OCR0A = mixOut;
+
+  // software PWM for the LEDs
+  // (leds is the LED pins to leave high -- a pin is driven low to light its LED)
+  ledPwmCount = (ledPwmCount + 1) & (LED_LEVELS - 1);
+  leds = LED_MASK;
+  if (ledLevel[0] > ledPwmCount) leds &= ~_BV(PB1);
+  if (ledLevel[1] > ledPwmCount) leds &= ~_BV(PB2);
+  if (ledLevel[2] > ledPwmCount) leds &= ~_BV(PB3);
+#if LED_MAX_LIT < 3
+  // at the start of each PWM cycle, move the LED scan on to the next LED
+  if (ledPwmCount == 0) {
+    ledScan <<= 1;
+    if (ledScan > LED_BLUE) {
+      ledScan = LED_GREEN;
+    }
+  }
+  // (an LED is kept off by forcing its pin high)
+  #if LED_MAX_LIT == 1
+  leds |= LED_MASK & ~ledScan;  // only the LED whose turn it is can be on
+  #else
+  leds |= ledScan;              // all but one LED can be on
+  #endif
+#endif
+  PORTB = (PORTB & ~LED_MASK) | leds;
+
+  // count down to the next control tick
+  if (--controlCount == 0) {
+    controlCount = CONTROL_DIV;
+    controlTick = 1;
+  }
+
+  // step the phase accumulator
+  uint8_t step = phaseIncWhole;
+  phaseFrac += phaseIncFrac;
+  if (phaseFrac < phaseIncFrac) {
+    step++;  // phaseFrac carried over
+  }
+  if (step != 0) {
+    // it is time to move on to the next sample in gumballWavTab[]
+    if (samplesLeft > step) {
+      samplesLeft -= step;
+    } else {
+      samplesLeft = 0;
+      pitchPlaying = 0;  // tell main() we are done with this pitch
+    }
+#if BYTEBEAT
+    beatSteps += step;   // count t along with the samples
+#endif
+#if WAVE_FORMAT == WAVE_DELTA
+    // each delta only tells us how far a sample is from the one before it,
+    // so step through every sample on the way (step is 1, or 2 at the most at 1.2MHz)
+    do {
+      gumIndex++;
+      if (gumIndex >= wavSize) {
+        gumIndex = 0;
+        gumWavDat = gumballWavTabStart;
+        ledWrapped();
+      } else {
+        gumWavDat += wavDelta(gumIndex);
+      }
+    } while (--step);
+#else
+  #if KARPLUS
+    if (ksMode != PLUCK_OFF) {
+      gumWavDat = ksStep(step);
+    } else
+  #endif
+    {
+      gumIndex += step;
+      // go back round to the beginning if we reached the end of the table
+      // (this takes the same time however many wave tables there are in wavBank[])
+  #if WINDOW
+      if (gumIndex >= winSize) {
+        gumIndex -= winSize;
+        ledWrapped();
+      }
+      gumWavDat = wavSample(winIndex(gumIndex));
+    #if INTERP
+      if (interpOn) {
+        // read the sample after this one too, to slide to
+        uint8_t next = gumIndex + 1;
+        if (next >= winSize) {
+          next = 0;
+        }
+        gumLeft = gumWavDat;
+        gumRight = wavSample(winIndex(next));
+      }
+    #endif
+  #else
+      if (gumIndex >= wavSize) {
+        gumIndex -= wavSize;
+        ledWrapped();
+      }
+      gumWavDat = wavSample(gumIndex);
+    #if INTERP
+      if (interpOn) {
+        // read the sample after this one too, to slide to
+        uint8_t next = gumIndex + 1;
+        if (next >= wavSize) {
+          next = 0;
+        }
+        gumLeft = gumWavDat;
+        gumRight = wavSample(next);
+      }
+    #endif
+  #endif
+    }
+#endif
+  }
+#if INTERP
+  if (interpOn) {
+    gumWavDat = wavBlend(gumLeft, gumRight, phaseFrac >> 8);
+  }
+#endif
+#if FM
+  if (fmOn) {
+    gumWavDat = fmStep();  // play from where the modulator moves us to
+  }
+#endif
+#if BYTEBEAT
+  if (beatOn) {
+    gumWavDat = beatOut;   // play the formula instead
+  }
+#endif
+
+  // step the other voices, and mix them all together for next time
+#if DITHER
+  // (the same, but keep the bits that are usually rounded off -- see "Dither")
+  uint16_t fine;
+  #if VOICES == 1
+  fine = (uint16_t)gumWavDat << 8;
+  #elif VOICES == 2
+  voiceStep(&voice[0]);
+  fine = ( (uint16_t)gumWavDat + voice[0].wavDat ) << 7;
+  #else
+  voiceStep(&voice[0]);
+  voiceStep(&voice[1]);
+  fine = ( ((uint16_t)gumWavDat << 1) + voice[0].wavDat + voice[1].wavDat ) << 6;
+  #endif
+  #if NOISE
+  fine = (uint16_t)noiseStep(fine >> 8) << 8;
+  #endif
+  #if ENVELOPE
+  fine = 0x8000 + envMul(fine >> 8);
+  #endif
+  mixOut = ditherStep(fine);
+#else
+  #if VOICES == 1
+  mixOut = gumWavDat;
+  #elif VOICES == 2
+  voiceStep(&voice[0]);
+  mixOut = ( (uint16_t)gumWavDat + voice[0].wavDat ) >> 1;
+  #else
+  voiceStep(&voice[0]);
+  voiceStep(&voice[1]);
+  mixOut = ( ((uint16_t)gumWavDat << 1) + voice[0].wavDat + voice[1].wavDat ) >> 2;
+  #endif
+  #if NOISE
+  mixOut = noiseStep(mixOut);
+  #endif
+  #if ENVELOPE
+  mixOut = envScale(mixOut);
+  #endif
+#endif
+}
+
+
+
+//--------------------
+// This function changes to wave table number n in wavBank[]
+void setTimbre(uint8_t n) {
+  const uint8_t *data;
+  uint8_t size;
+
+  if (n >= WAV_BANK_COUNT) {
+    n = 0;   // there is no wave table n, so use the first one
+  }
+  data = pgm_read_ptr( &( wavBank[n].wavData ) );
+  size = pgm_read_byte( &( wavBank[n].wavSize ) );
+  if (data != wavData) {
+    // the interrupt uses these values, so make sure it does not run while we change them
+    cli();
+    wavData = data;
+    wavSize = size;
+    gumIndex = 0;   // start at the beginning of the new wave table
+#if MIPMAP
+    wavTimbre = n;
+    mipLevel = 0;   // mipPick() picks the level for each pitch
+#endif
+#if VOICES > 1
+    for (uint8_t v=0; v<VOICES-1; v++) {
+      voice[v].wavIndex = 0;
+    }
+#endif
+#if FM
+    fmSetShift();   // the depth might have to change for the new length
+#endif
+#if WINDOW
+    winStart = 0;   // play all of the new wave table
+    winSize = size;
+    winDriftEvery = 0;
+#endif
+    sei();
+  }
+}
+
+
+
+//--------------------
+// This function works out the phase step for a pitch (a gumballPitch value)
+// This divide takes a while, but it only happens once for each pitch (and not for each sample)
+uint32_t pitchStep(uint8_t pitchRate) {
+  return PHASE_STEP_K / pitchRate;
+}
+
+
+
+#if INTERP || MIPMAP
+//--------------------
+// This function tells us if the first voice is playing the wave table
+// (and not plucked strings, phase modulation, or bytebeat)
+uint8_t wavTabPlaying(void) {
+#if KARPLUS
+  if (ksMode != PLUCK_OFF) return 0;
+#endif
+#if FM
+  if (fmOn) return 0;
+#endif
+#if BYTEBEAT
+  if (beatOn) return 0;
+#endif
+  return 1;
+}
+#endif
+
+
+
+#if MIPMAP
+//--------------------
+// This function picks the level of the wave table to play for phase step inc
+// (see "Mip-mapped wave tables"), and hands back the phase step for that level
+uint32_t mipPick(uint32_t inc) {
+  const uint8_t *data = pgm_read_ptr( &( wavBank[wavTimbre].wavData ) );
+  const uint8_t *mip;
+  uint8_t size = pgm_read_byte( &( wavBank[wavTimbre].wavSize ) );
+  uint8_t level = 0;
+
+  // halve the step (and the table) until it is less than a whole sample
+  if (wavTabPlaying()) {
+    while ((inc >> 16) != 0 && level < MIP_LEVELS) {
+      mip = pgm_read_ptr( &( wavMip[wavTimbre][level] ) );
+      if (mip == 0) {
+        break;   // this wave table has no more levels
+      }
+      data = mip;
+      size >>= 1;
+      inc >>= 1;
+      level++;
+    }
+  }
+
+  if (level != mipLevel) {
+    // the interrupt uses these values, so make sure it does not run while we change them
+    cli();
+    wavData = data;
+    wavSize = size;
+    // go on from the same place in the waveform
+    if (level > mipLevel) {
+      gumIndex >>= (level - mipLevel);
+    } else {
+      gumIndex <<= (mipLevel - level);
+    }
+    sei();
+    mipLevel = level;
+  }
+  return inc;
+}
+#endif
+
+
+
+//--------------------
+// This function starts playing a new pitch.
+// It works out the phase step for the pitch, and then hands it to the Timer0 interrupt.
+void playPitch(uint8_t pitchRate, uint16_t pitchLen) {
+  uint32_t inc;
+#if INTERP
+  uint8_t  interp;
+
+  // interpolate low pitches, but only when the first voice is playing the wave table
+  interp = (pitchRate >= INTERP_PITCH) && wavTabPlaying();
+#endif
+
+  inc = pitchStep(pitchRate);
+#if MIPMAP
+  inc = mipPick(inc);
+  // samplesLeft counts samples of the level we play, and a shorter level has fewer of them
+  pitchLen >>= mipLevel;
+  #if ENVELOPE
+  envReleaseAt >>= mipLevel;
+  #endif
+#endif
+
+#if LFO
+  vibBase = inc;
+#endif
+#if ARPEGGIO
+  arpBase = inc;
+#endif
+
+  // the interrupt uses these values, so make sure it does not run while we change them
+  cli();
+  phaseIncFrac = (uint16_t)inc;
+  phaseIncWhole = (uint8_t)(inc >> 16);
+  samplesLeft = pitchLen;
+  pitchPlaying = (pitchLen != 0);
+#if INTERP
+  if (interp && !interpOn) {
+    // hold the sample that is playing until the next step reads two new ones
+    gumLeft = gumWavDat;
+    gumRight = gumWavDat;
+  }
+  interpOn = interp;
+#endif
+  sei();
+}
+
+
+
+#if VOICES > 1
+//--------------------
+// This function sets the pitch of voice n (0 for voice 2, 1 for voice 3)
+// A pitchRate of 0 makes the voice quiet.
+void setVoice(uint8_t n, uint8_t pitchRate) {
+  uint32_t inc = 0;
+
+  if (pitchRate != 0) {
+    inc = pitchStep(pitchRate);
+  }
+  cli();
+  voice[n].phaseIncFrac = (uint16_t)inc;
+  voice[n].phaseIncWhole = (uint8_t)(inc >> 16);
+  if (inc == 0) {
+    voice[n].wavDat = 0x80;   // quiet -- right in the middle
+  }
+  sei();
+}
+#endif
+
+
+
+#if NOISE
+//--------------------
+// This function sets the noise channel (value is made by NOISE_SET)
+void setNoise(uint16_t value) {
+  uint8_t period = value;
+  uint8_t mix = (value >> 8) & 0x07;
+
+  if (period == 0) {
+    mix = 0;       // off
+    period = 1;
+  }
+  if (mix > 4) {
+    mix = 4;
+  }
+  cli();
+  noisePeriod = period;
+  if (value & ((uint16_t)NOISE_SHORT << 8)) {
+    noiseTaps = 0x0060;
+    lfsr &= 0x7F;    // just the 7 bits the short register uses
+  } else {
+    noiseTaps = 0xB400;
+  }
+  if (lfsr == 0) {
+    lfsr = 1;        // it must never be 0
+  }
+  noiseMix = mix;
+  sei();
+}
+#endif
+
+
+
+#if ENVELOPE
+//--------------------
+// This function sets the envelope gain the interrupt uses for envLevel
+void envSetGain(void) {
+  envGain = pgm_read_byte( &( envGainTab[envLevel >> 3] ) );
+}
+
+
+
+//--------------------
+// This function starts the envelope over again, for a new pitch that lasts pitchLen samples
+// (or pitchLen score ticks, if NOTE_TIME is 1)
+void envStart(uint16_t pitchLen) {
+  if (envShape & 0x000F) {
+    envStage = ENV_ATTACK;
+    envLevel = ENV_SILENT;
+  } else {
+    envStage = ENV_DECAY;    // no attack -- start at full volume
+    envLevel = 0;
+  }
+  envReleaseAt = pitchLen >> 2;
+  envSetGain();
+}
+
+
+
+//--------------------
+// This function moves the envelope on (it runs at the control rate, like ledUpdate())
+void envUpdate(void) {
+  uint8_t  level = envLevel;
+  uint8_t  sustain = (envShape >> 4) & 0xF0;   // the sustain level in 1/8ths (3dB is 2 levels, which is 16 1/8ths)
+  uint8_t  release = envShape >> 12;
+  uint16_t left;
+  uint8_t  step;
+
+  if (envStage != ENV_RELEASE && release != 0) {
+#if NOTE_TIME
+    left = noteTicks;       // (this is 0 for a GLIDE(), which does not release until it is over)
+    if (left != 0 && left <= envReleaseAt) {
+#else
+    // samplesLeft is 16 bits, so stop the interrupt while we read it
+    cli();
+    left = samplesLeft;
+    sei();
+    if (left <= envReleaseAt) {
+#endif
+      envStage = ENV_RELEASE;
+    }
+  }
+
+  switch (envStage) {
+    case ENV_ATTACK:
+      step = pgm_read_byte( &( envRateTab[envShape & 0x0F] ) );
+      if (level > step) {
+        level -= step;
+      } else {
+        level = 0;
+        envStage = ENV_DECAY;
+      }
+      break;
+    case ENV_DECAY:
+      step = pgm_read_byte( &( envRateTab[(envShape >> 4) & 0x0F] ) );
+      if ((uint16_t)level + step < sustain) {
+        level += step;
+      } else {
+        level = sustain;
+        envStage = ENV_SUSTAIN;
+      }
+      break;
+    case ENV_RELEASE:
+      step = pgm_read_byte( &( envRateTab[release] ) );
+      if ((uint16_t)level + step < ENV_SILENT) {
+        level += step;
+      } else {
+        level = ENV_SILENT;
+      }
+      break;
+  }
+
+  envLevel = level;
+  envSetGain();
+}
+#endif
+
+
+
+#if KARPLUS
+//--------------------
+// This function turns plucked strings on (PLUCK_NOISE or PLUCK_WAVE) or off (PLUCK_OFF)
+void setPluck(uint8_t mode) {
+  // gumIndex has to start again at 0, since ksBuf[] and the wave table are different lengths
+  cli();
+  ksMode = mode;
+  gumIndex = 0;
+#if FM
+  fmSetOn();         // phase modulation waits while the strings are plucked
+#endif
+  sei();
+}
+
+
+
+//--------------------
+// This function plucks the string, by filling ksBuf[] with noise or with the wave table
+// (the interrupt might play a sample or two while we do this, but that is fine -- it is the pluck)
+void ksPluck(void) {
+  uint8_t w = 0;
+
+  for (uint8_t i=0; i<KS_SIZE; i++) {
+    if (ksMode == PLUCK_NOISE) {
+      if (i & 1) {
+        // every other sample is the opposite of the one before, so the noise
+        // averages out to the middle (0x80) and the string fades away to silence there
+        ksBuf[i] = ~ksBuf[i-1];
+      } else {
+        // step an 8-bit LFSR (like the one in the noise channel) 8 times, for 8 new bits
+        for (uint8_t b=0; b<8; b++) {
+          ksSeed = (ksSeed & 1) ? (ksSeed >> 1) ^ 0xB8 : (ksSeed >> 1);
+        }
+        ksBuf[i] = ksSeed;
+      }
+    } else {
+      ksBuf[i] = wavSample(w);
+      if (++w >= wavSize) {
+        w = 0;
+      }
+    }
+  }
+}
+#endif
+
+
+
+#if BYTEBEAT
+//--------------------
+// This function plays bytebeat formula n in beatBank[] (1 is the first one), or the wave table again (n=0)
+void setBeat(uint8_t n) {
+  if (n == 0 || n > BEAT_COUNT) {
+    beatOn = 0;
+  } else {
+    beatCode = pgm_read_ptr( &( beatBank[n-1] ) );
+    beatT = 0xFFFF;   // so beatUpdate() works out the formula straight away
+    beatOn = 1;
+  }
+}
+
+
+
+//--------------------
+// This function works out the formula at beatCode for time t
+uint8_t beatRun(uint16_t t) {
+  const uint8_t *pc = beatCode;
+  uint16_t acc = 0;
+  uint16_t x = 0;
+  uint16_t m;
+  uint8_t op, n;
+
+  while (1) {
+    op = pgm_read_byte(pc++);
+    n = op & 0x0F;
+    switch (op & 0xF0) {
+      case BB_END:     return acc;
+      case BB_T(0):    acc = t >> n;  break;
+      case BB_OR(0):   acc |= t >> n; break;
+      case BB_AND(0):  acc &= t >> n; break;
+      case BB_XOR(0):  acc ^= t >> n; break;
+      case BB_ADD(0):  acc += t >> n; break;
+      case BB_SUB(0):  acc -= t >> n; break;
+      case BB_SHR(0):  acc >>= n;     break;
+      case BB_SHL(0):  acc <<= n;     break;
+      case BB_MUL(0):
+        // the ATtiny13a has no MUL instruction, so add up acc*1, acc*2, acc*4, acc*8 for each bit of n
+        m = acc;
+        acc = 0;
+        while (n) {
+          if (n & 1) {
+            acc += m;
+          }
+          m <<= 1;
+          n >>= 1;
+        }
+        break;
+      case BB_MASK(0): acc &= (1 << n) - 1; break;
+      case BB_SAVE:    x = acc;       break;
+      case BB_OR_X:    acc |= x;      break;
+      case BB_AND_X:   acc &= x;      break;
+      case BB_XOR_X:   acc ^= x;      break;
+      case BB_ADD_X:   acc += x;      break;
+    }
+  }
+}
+
+
+
+//--------------------
+// This function works out the next bytebeat sample, if t has moved on (main() calls it after every sample)
+void beatUpdate(void) {
+  uint16_t steps, frac, t;
+
+  // t is 16 counts for each sample the first voice has played, plus the fraction of the one it is on
+  cli();
+  steps = beatSteps;
+  frac = phaseFrac;
+  sei();
+  t = (steps << 4) | (frac >> 12);
+  if (t != beatT) {
+    beatT = t;
+    beatOut = beatRun(t);
+  }
+}
+#endif
+
+
+
+#if FM
+//--------------------
+// This function sets the phase modulation (value is made by FM_SET)
+void setFm(uint16_t value) {
+  cli();
+  fmShape = value;
+  fmSetShift();
+  fmSetOn();
+  sei();
+}
+
+
+
+//--------------------
+// This function starts the modulator for a new pitch, at ratio/2 times the speed
+// the first voice goes round its wave table
+void fmStart(uint8_t pitchRate) {
+  uint32_t inc = pitchStep(pitchRate);
+  uint32_t fmInc = 0;
+
+  // fmInc = inc * ratio/2 * FM_SINE_SIZE / wavSize  (the multiply is just adds, since ratio is small)
+  for (uint8_t r = fmShape & 0x0F; r != 0; r--) {
+    fmInc += inc;
+  }
+#if MIPMAP
+  // the pitch will play the whole wave table (see mipPick()), even if the one before did not
+  fmInc = (fmInc * (FM_SINE_SIZE / 2)) / pgm_read_byte( &( wavBank[wavTimbre].wavSize ) );
+#else
+  fmInc = (fmInc * (FM_SINE_SIZE / 2)) / wavSize;
+#endif
+
+  cli();
+  fmIncFrac = (uint16_t)fmInc;
+  fmIncWhole = (uint8_t)(fmInc >> 16);
+  fmFrac = 0;
+  fmIndex = 0;
+  sei();
+}
+#endif
+
+
+
+#if WINDOW
+//--------------------
+// This function sets the window onto the wave table (value is made by WINDOW_SET)
+void setWindow(uint16_t value) {
+  uint8_t size = wavSize;
+  uint8_t start = value & 0x7F;
+  uint8_t length = ((value >> 7) & 0x3F) << 1;
+  uint8_t drift = value >> 13;
+
+  while (start >= size) {
+    start -= size;   // a start past the end goes round to the beginning
+  }
+  if (length == 0 || length > size) {
+    length = size;   // all of it
+  } else if (length < 4) {
+    length = 4;      // at 1.2MHz we can step 2 samples at a time, so it has to be longer than that
+  }
+  cli();
+  winStart = start;
+  winSize = length;
+  gumIndex = 0;      // start at the beginning of the window
+  sei();
+  winDriftEvery = drift ? (1 << (7 - drift)) : 0;
+  winDriftCount = winDriftEvery;
+}
+
+
+
+//--------------------
+// This function slides the window along (it runs at the control rate, like ledUpdate())
+void winUpdate(void) {
+  if (winDriftEvery != 0 && --winDriftCount == 0) {
+    uint8_t start = winStart + 1;
+    winDriftCount = winDriftEvery;
+    if (start >= wavSize) {
+      start = 0;
+    }
+    winStart = start;   // a single byte, so the interrupt cannot see half of it
+  }
+}
+#endif
+
+
+
+#if PORTAMENTO
+//--------------------
+// This function starts a glide from pitch "from" to glideTo, that takes "ticks" control ticks
+void glideStart(uint8_t from, uint16_t ticks) {
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  glidePitch = (uint16_t)from << 8;
+  glideStep = ( (int32_t)((int16_t)glideTo - from) << 8 ) / ticks;
+  glideTicks = ticks;
+  playPitch(from, 0xFFFF);   // glideUpdate() will say when it is over
+}
+
+
+
+//--------------------
+// This function moves the glide on (it runs at the control rate, like ledUpdate())
+void glideUpdate(void) {
+  uint32_t inc;
+
+  if (glideTicks == 0) {
+    return;
+  }
+  if (--glideTicks == 0) {
+    // the glide is over
+    cli();
+    samplesLeft = 0;
+    pitchPlaying = 0;
+    sei();
+    return;
+  }
+  glidePitch += glideStep;
+  inc = ((uint32_t)PHASE_STEP_K << 8) / glidePitch;   // the same as pitchStep(), but with the fraction as well
+#if MIPMAP
+  inc >>= mipLevel;   // the glide stays at the level it started on
+#endif
+#if LFO
+  vibBase = inc;      // vibUpdate() wobbles it (and it comes after this, in the same control tick)
+#endif
+#if ARPEGGIO
+  arpBase = inc;      // arpUpdate() moves it to the note of the chord (it comes after this too)
+#endif
+
+  cli();
+  phaseIncFrac = (uint16_t)inc;
+  phaseIncWhole = (uint8_t)(inc >> 16);
+  samplesLeft = 0xFFFF;   // keep the interrupt playing until the glide is over
+  sei();
+}
+#endif
+
+
+
+#if LFO
+//--------------------
+// This function starts the vibrato over again for a new pitch
+void vibStart(void) {
+  vibShape = vibNext;
+  vibPhase = 0x4000;   // start in the middle of the triangle, going up
+}
+
+
+
+//--------------------
+// This function moves the LFO on, and wobbles the phase step the interrupt
+// plays (it runs at the control rate, like ledUpdate())
+void vibUpdate(void) {
+  uint8_t  depth = vibShape >> 4;
+  uint8_t  tri;
+  int16_t  amount = 0;
+  int32_t  base;
+  int32_t  delta = 0;
+  uint32_t inc;
+
+  if (depth == 0) {
+    return;
+  }
+  for (uint8_t r = vibShape & 0x0F; r != 0; r--) {
+    vibPhase += VIB_STEP;
+  }
+
+  // the triangle: 0 to 127 and back down again, then take 64 off (so it is -64 to 63)
+  tri = vibPhase >> 8;
+  if (tri & 0x80) {
+    tri = ~tri;
+  }
+  for (; depth != 0; depth--) {
+    amount += (int8_t)(tri - 64);    // amount = (triangle - 64) * depth, with adds
+  }
+
+  // delta = vibBase * amount, one bit of amount at a time
+  base = (int32_t)vibBase;
+  if (amount < 0) {
+    amount = -amount;
+    base = -base;      // (a negative amount takes it away instead)
+  }
+  while (amount != 0) {
+    if (amount & 1) {
+      delta += base;
+    }
+    base <<= 1;
+    amount >>= 1;
+  }
+  inc = vibBase + (delta >> 13);
+
+  cli();
+  phaseIncFrac = (uint16_t)inc;
+  phaseIncWhole = (uint8_t)(inc >> 16);
+  sei();
+}
+#endif
+
+
+
+#if ARPEGGIO
+//--------------------
+// This function sets the arpeggio (value is made by ARP_SET)
+void setArp(uint16_t value) {
+  if ((value & 0x0F) == 0) {
+    value = 0;          // no note1 means no chord
+  } else if ((value >> 12) == 0) {
+    value |= 0x1000;    // a speed of 0 is the same as 1
+  }
+  arpShape = value;
+}
+
+
+
+//--------------------
+// This function starts the chord over again for a new pitch
+void arpStart(void) {
+  arpStep = 0;
+  arpCount = arpShape >> 12;
+}
+
+
+
+//--------------------
+// This function finds how many semitones above the pitch note "step" of the chord is
+static uint8_t arpNote(uint8_t step) {
+  uint16_t shape = arpShape;
+
+  if (step == 0) {
+    return 0;           // the pitch itself
+  }
+  while (--step != 0) {
+    shape >>= 4;
+  }
+  return shape & 0x0F;
+}
+
+
+
+//--------------------
+// This function moves the arpeggio on, and sets the phase step the interrupt
+// plays to the note of the chord (it runs at the control rate, like ledUpdate())
+void arpUpdate(void) {
+  uint8_t  semi;
+  uint8_t  octave = 0;
+  uint16_t ratio;
+  uint32_t delta = 0;
+  uint32_t inc;
+
+  if (arpShape == 0) {
+    return;
+  }
+  if (--arpCount == 0) {
+    arpCount = arpShape >> 12;
+    arpStep++;
+    if (arpStep > 3 || arpNote(arpStep) == 0) {
+      arpStep = 0;      // back to the pitch, after the last note of the chord
+    }
+  }
+  semi = arpNote(arpStep);
+  if (semi >= 12) {
+    semi -= 12;
+    octave = 1;
+  }
+
+  // delta = arpBase * ratio / 4096, one bit of ratio at a time (the lowest first,
+  // halving as we go, so it never gets bigger than arpBase)
+  ratio = pgm_read_word( &( arpRatioTab[semi] ) );
+  for (uint8_t b = 12; b != 0; b--) {
+    if (ratio & 1) {
+      delta += arpBase;
+    }
+    delta >>= 1;
+    ratio >>= 1;
+  }
+  inc = (arpBase + delta) << octave;
+#if LFO
+  vibBase = inc;        // vibUpdate() wobbles the note of the chord (it comes after this)
+#endif
+
+  cli();
+  phaseIncFrac = (uint16_t)inc;
+  phaseIncWhole = (uint8_t)(inc >> 16);
+  sei();
+}
+#endif
+
+
+
+#if NOTE_TIME
+//--------------------
+// This function starts a NOTE() that lasts "ticks" score ticks
+void noteStart(uint8_t pitchRate, uint16_t ticks) {
+  tempoStep = tempoNext;
+  noteTicks = ticks;
+  playPitch(pitchRate, (ticks != 0) ? 0xFFFF : 0);   // noteUpdate() will say when it is over
+}
+
+
+
+//--------------------
+// This function counts the score ticks (it runs at the control rate, like ledUpdate())
+void noteUpdate(void) {
+  uint16_t count;
+
+  if (noteTicks == 0) {
+    return;
+  }
+  count = tempoCount + tempoStep;
+  if (count < tempoCount) {
+    // it went round, so that is a score tick
+    if (--noteTicks == 0) {
+      cli();
+      samplesLeft = 0;
+      pitchPlaying = 0;
+      sei();
+    }
+  }
+  tempoCount = count;
+  if (noteTicks != 0) {
+    cli();
+    samplesLeft = 0xFFFF;   // keep the interrupt playing until the note is over
+    sei();
+  }
+}
+#endif
+
+
+
+//--------------------
+// This function starts up Timer0 to play the samples
+void startSound(void) {
+  // initialize Timer0 in Fast PWM mode (from BOT (0x00) to MAX (0xFF) with Compare Match on OC0A value),
+  // with OC0A outputting on PB0 pin, with no prescaling
+  DDRB |= _BV(PB0);                // set OC0A PWM pin (PB0) as output
+  TCCR0A = 0;                      // start with the Timer0 settings cleared (they are not, after we wake up)
+  TCCR0B = 0;
+  TCCR0A |= _BV(COM0A1);           // TCCR0A -- COM0A1:COM0A0=10 to clear OC0A on Compare Match, set OC0A at TOP
+                                   // TCCR0A -- COM0B1:COM0B0=00 for Timer0 OC0B disconnected
+                                   // TCCR0A -- bits 3:2 are unused
+  TCCR0A |= _BV(WGM01)|_BV(WGM00); // TCCR0A -- WGM01:WGM00=11 for Fast PWM mode (BOT to MAX, with Compare Match on OC0A value)
+                                   // TCCR0B -- FOC0A=0 for no force compare for Timer0 OC0A
+                                   // TCCR0B -- FOC0B=0 for no force compare for Timer0 OC0B
+                                   // TCCR0B -- bits 5:4 are unused
+                                   // TCCR0B -- WGM02=0 for Fast PWM mode (BOT to MAX, with Compare Match on OC0A value)
+  TCCR0B |= _BV(CS00);             // TCCR0B -- CS02:CS00=001 for prescaling=1 (no prescaling)
+  TIMSK0 |= _BV(TOIE0);            // TIMSK0 -- TOIE0=1 to enable the Timer0 Overflow interrupt (this plays the samples)
+}
+
+
+
+//--------------------
+// Power management
+//
+// Every uA counts on a CR2032, so we turn off everything we do not use, and we
+// make sure no pin is left floating (a floating input can use lots of current
+// when it drifts to half-way between 0 and 1).
+// powerMode() is called when we start up, and every time we change between
+// playing and sleeping:
+//   POWER_PLAYING  -- Timer0 on, everything else off
+//   POWER_SLEEPING -- Timer0 off too, the LED pins high (off), and the speaker pin low
+//
+// What is turned off:
+//   ADC                   -- its clock is stopped with PRR (we never use it)
+//   Analog Comparator     -- ACSR.ACD (it is on after reset, and stays on even in Power-down!)
+//   digital input buffers -- DIDR0, on every pin we never read (PB0..PB3 are outputs)
+//   PB4                   -- input with pull-up if it has the wake-up switch, otherwise driven low
+//   brown-out detector    -- this is already off in the fuses (BODLEVEL1:BODLEVEL0=11, see burn-fuse in
+//                              the Makefile).  If you turn it on in the fuses it adds about 20uA, even in Power-down
+//   PB5 (pin 1)           -- this is RESET, which has its own internal pull-up
+//
+// Roughly how much current this takes at 3V (from the ATtiny13a datasheet, not counting the LEDs or speaker):
+//   playing at 9.6MHz -- about 1mA (the CPU sleeps in Idle mode between samples)
+//   playing at 1.2MHz -- about 0.2mA
+//   Power-down        -- less than 1uA
+// Each LED that is on adds about 1mA more (through its 1K resistor).
+#define POWER_PLAYING   0
+#define POWER_SLEEPING  1
+
+#if PLAY_COUNT != 0
+  #define PB4_DIDR  0            // PB4 is read (for the wake-up switch), so keep its input buffer
+#else
+  #define PB4_DIDR  _BV(ADC2D)   // PB4 is not used, so turn off its input buffer too
+#endif
+
+void powerMode(uint8_t mode) {
+  ACSR |= _BV(ACD);      // ACSR -- ACD=1 to turn off the Analog Comparator
+  DIDR0 = _BV(AIN0D)|_BV(AIN1D)|_BV(ADC1D)|_BV(ADC3D)|PB4_DIDR;  // DIDR0 -- turn off the digital input buffers on PB0..PB3 (and PB4 if not used)
+
+#if PLAY_COUNT != 0
+  // PB4 is an input with its pull-up turned on, so pressing the switch pulls it low
+  DDRB &= ~_BV(PB4);
+  PORTB |= _BV(PB4);
+#else
+  // PB4 is not connected to anything, so drive it low
+  PORTB &= ~_BV(PB4);
+  DDRB |= _BV(PB4);
+#endif
+
+  if (mode == POWER_PLAYING) {
+    PRR = _BV(PRADC);                // PRR -- PRADC=1 to stop the clock to the ADC, PRTIM0=0 to keep Timer0 running
+  } else {
+    // stop Timer0, and disconnect it from PB0
+    TIMSK0 = 0;
+    TCCR0B = 0;
+    TCCR0A = 0;
+    PRR = _BV(PRADC)|_BV(PRTIM0);    // PRR -- PRADC=1 and PRTIM0=1 to stop the clocks to the ADC and Timer0
+    // turn off the LEDs -- they go from +3V to the pin, so they are off when the pin is high
+    // (driving them low here would light all 3 of them, at about 3mA, for as long as we sleep)
+    // and drive the speaker pin low (the 1000uF cap means no current flows either way)
+    // (there is nothing to put back when we wake up -- the interrupt sets the LED pins again
+    // every sample, as soon as startSound() turns it back on)
+    PORTB = (PORTB & ~_BV(PB0)) | LED_MASK;
+  }
+}
+
+
+
+#if PLAY_COUNT != 0
+//--------------------
+// This function puts everything into its lowest-current state, and goes into
+// Power-down sleep until the switch on PB4 is pressed.
+// In Power-down all of the clocks stop, so only a pin change can wake us up.
+void sleepUntilButton(void) {
+  powerMode(POWER_SLEEPING);
+
+  PCMSK = _BV(PCINT4);   // PCMSK -- PCINT4=1 so a change on PB4 causes a Pin Change interrupt
+  GIMSK |= _BV(PCIE);    // GIMSK -- PCIE=1 to enable the Pin Change interrupt
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  // go back to sleep unless PB4 is really low (pressed)
+  // (this ignores the switch being let go of, and bouncing back up)
+  // (interrupts are off from clearing PCIF until sleep_cpu(), so a press in
+  // between cannot be handled before we are asleep, and then missed -- the
+  // instruction after sei() always runs before any interrupt, so a Pin Change
+  // from then on wakes us up again)
+  do {
+    cli();
+    GIFR = _BV(PCIF);    // clear any Pin Change we already had
+    if (PINB & _BV(PB4)) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    sei();
+  } while (PINB & _BV(PB4));
+
+  // we are awake -- stop listening to PB4 until next time
+  GIMSK &= ~_BV(PCIE);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  powerMode(POWER_PLAYING);
+  startSound();
+}
+
+
+
+//--------------------
+// Pin Change interrupt -- all it has to do is wake us up
+EMPTY_INTERRUPT(PCINT0_vect);
+#endif
+
+
+
+//--------------------
+// The score player
+//
+// vmNext() runs the program in pitchTab[] until it gets to the next NOTE() or
+// CMD(), and hands it back to main().  CALL() and REPEAT() remember where to
+// come back to (and how many more times to play the phrase) on vmStack[].
+// main() calls it while the interrupt is playing the pitch before, so it has
+// plenty of time -- but to be sure it can never take too long (or go round
+// and round for ever, if pitchTab[] has a mistake in it), it does at most
+// VM_MAX_STEPS CALLs, RETs, and JUMPs before it must find a NOTE() or CMD().
+// If it does not, that is the end of the composition.
+// Each place on vmStack[] takes 3 bytes of RAM.
+#ifndef VM_DEPTH
+#define VM_DEPTH      2   // how deep phrases can CALL each other
+#endif
+#define VM_MAX_STEPS  8   // how many CALLs, RETs, and JUMPs it can do to find the next NOTE() or CMD()
+
+struct vmFrame {
+  uint8_t ret;     // where to go back to in pitchTab[] at the end of the phrase
+  uint8_t count;   // how many more times to play the phrase
+  uint8_t start;   // where the phrase starts in pitchTab[]
+};
+struct vmFrame vmStack[VM_DEPTH];
+uint8_t vmDepth;   // how many places on vmStack[] are in use
+uint8_t vmPc;      // where we are in pitchTab[]
+uint8_t vmCmd;     // the command of the CMD() that vmNext() found
+
+
+
+//--------------------
+// This function starts the score player at the beginning of pitchTab[]
+void vmStart(void) {
+  vmPc = 0;
+  vmDepth = 0;
+#if NOTE_TIME
+  tempoNext = TEMPO_STEP(TEMPO_BPM);
+#endif
+#if LFO
+  vibNext = 0;
+#endif
+}
+
+
+
+//--------------------
+// This function turns the 1-byte length of a NOTE() (see NOTE_LEN) back into
+// a pitchDuration.  It only needs shifts, so it is quick even without a
+// multiply instruction.
+uint16_t noteLength(uint8_t code) {
+  uint8_t  shift = code >> 5;
+  uint16_t len;
+
+  if (shift < 2) {
+    return code;             // lengths up to 63 are kept just as they are
+  }
+  len = (code & 0x1F) | 0x20;
+  while (--shift != 0) {
+    len <<= 1;
+  }
+  return len;
+}
+
+
+
+//--------------------
+// This function finds the next NOTE() or CMD() in pitchTab[].
+// It hands back the gumballPitch (or VM_CMD, with the command in vmCmd --
+// or CMD_END at the end), and puts the pitchDuration (or the command's value)
+// in *value.  (Only the pitches have to be PITCH_LOWEST or more, so there can
+// be more commands than there is room for below PITCH_LOWEST.)
+uint8_t vmNext(uint16_t *value) {
+  uint8_t op, n, at;
+  uint8_t pc = vmPc;
+  struct vmFrame *frame;
+
+  for (uint8_t steps=0; steps<VM_MAX_STEPS; steps++) {
+    op = pgm_read_byte( &( pitchTab[pc] ) );
+    if (op >= PITCH_LOWEST) {
+      // NOTE(gumballPitch, pitchDuration)
+      *value = noteLength( pgm_read_byte( &( pitchTab[pc+1] ) ) );
+      vmPc = pc + 2;
+#if PORTAMENTO
+      glideTo = 0;
+#endif
+      return op;
+    }
+    switch (op) {
+      case VM_LONGNOTE:
+        op = pgm_read_byte( &( pitchTab[pc+1] ) );
+        *value = pgm_read_word( &( pitchTab[pc+2] ) );
+        vmPc = pc + 4;
+#if PORTAMENTO
+        glideTo = 0;
+#endif
+        return op;
+#if PORTAMENTO
+      case VM_GLIDE:
+        // this is played like a NOTE(from, ticks), with glideTo set
+        op = pgm_read_byte( &( pitchTab[pc+1] ) );
+        glideTo = pgm_read_byte( &( pitchTab[pc+2] ) );
+        *value = pgm_read_word( &( pitchTab[pc+3] ) );
+        vmPc = pc + 5;
+        return op;
+#endif
+#if LFO
+      case VM_VIBRATO:
+        vibNext = pgm_read_byte( &( pitchTab[pc+1] ) );
+        pc += 2;
+        break;
+#endif
+#if NOTE_TIME
+      case VM_TEMPO:
+        tempoNext = pgm_read_word( &( pitchTab[pc+1] ) );
+        pc += 3;
+        break;
+#endif
+      case VM_CMD:
+        vmCmd = pgm_read_byte( &( pitchTab[pc+1] ) );
+        *value = pgm_read_word( &( pitchTab[pc+2] ) );
+        vmPc = pc + 4;
+        return VM_CMD;
+      case VM_CALL:
+      case VM_REPEAT:
+        if (op == VM_CALL) {
+          n = 1;
+          at = pgm_read_byte( &( pitchTab[pc+1] ) );
+          pc += 2;
+        } else {
+          n = pgm_read_byte( &( pitchTab[pc+1] ) );
+          at = pgm_read_byte( &( pitchTab[pc+2] ) );
+          pc += 3;
+        }
+        if (n != 0 && vmDepth < VM_DEPTH) {   // (if it is too deep, we skip the phrase)
+          frame = &vmStack[vmDepth++];
+          frame->ret = pc;
+          frame->count = n - 1;
+          frame->start = at;
+          pc = at;
+        }
+        break;
+      case VM_RET:
+        if (vmDepth == 0) {
+          return CMD_END;    // there was no CALL
+        }
+        frame = &vmStack[vmDepth - 1];
+        if (frame->count != 0) {
+          frame->count--;
+          pc = frame->start;   // play the phrase again
+        } else {
+          pc = frame->ret;
+          vmDepth--;
+        }
+        break;
+      case VM_JUMP:
+        pc = pgm_read_byte( &( pitchTab[pc+1] ) );
+        break;
+      default:
+        return CMD_END;      // VM_END (or a mistake)
+    }
+  }
+  return CMD_END;            // too many steps without finding a NOTE() or CMD()
+}
+
+
+
+//--------------------
+// This function does a command from pitchTab[] (see CMD_TIMBRE, etc.)
+void doCommand(uint8_t cmd, uint16_t value) {
+  switch (cmd) {
+    case CMD_TIMBRE:
+      setTimbre(value);
+      break;
+#if VOICES > 1
+    case CMD_VOICE2:
+      setVoice(0, value);
+      break;
+#endif
+#if VOICES > 2
+    case CMD_VOICE3:
+      setVoice(1, value);
+      break;
+#endif
+#if NOISE
+    case CMD_NOISE:
+      setNoise(value);
+      break;
+#endif
+#if ENVELOPE
+    case CMD_ENV:
+      envShape = value;
+      break;
+#endif
+#if KARPLUS
+    case CMD_PLUCK:
+      setPluck(value);
+      break;
+#endif
+#if BYTEBEAT
+    case CMD_BEAT:
+      setBeat(value);
+      break;
+#endif
+#if FM
+    case CMD_FM:
+      setFm(value);
+      break;
+#endif
+#if WINDOW
+    case CMD_WINDOW:
+      setWindow(value);
+      break;
+#endif
+#if ARPEGGIO
+    case CMD_ARP:
+      setArp(value);
+      break;
+#endif
+  }
+}
+
+
+
+//--------------------
+int main(void) {
+
+  uint8_t  pitchRate;   // the gumballPitch of each NOTE() in pitchTab[] (the rate at which to play the waveform in gumballWavTab[])
+  uint16_t pitchLen;    // the pitchDuration of each NOTE() in pitchTab[] (the length of time to play a pitch)
+#if PLAY_COUNT != 0
+  uint8_t  playCount = 0;  // how many times we have played the composition since waking up
+#endif
+
+  // set the clock prescaler so the CPU runs at F_CPU
+  // (CLKPCE must be written first, and then the new value within 4 clock cycles -- C code
+  //  does not promise that, so clock_prescale_set() does the two writes in assembly)
+  clock_prescale_set(CLOCK_DIV);
+
+  // turn off everything we do not use (this has to come before startSound(), since it turns on Timer0's clock)
+  powerMode(POWER_PLAYING);
+  startSound();
+
+  // initialize PB1 (green), PB2 (red), PB3 (blue) as outputs (for LEDs)
+  DDRB |= _BV(PB1)|_BV(PB2)|_BV(PB3);
+
+  // the CPU has nothing to do while waiting for the next sample, so let it doze in Idle mode
+  // (Timer0 keeps running in Idle mode, and its interrupt wakes the CPU up again)
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  setTimbre(0);
+#if WAVE_FORMAT == WAVE_DELTA
+  gumWavDat = gumballWavTabStart;
+#else
+  gumWavDat = wavSample(0);
+#endif
+  sei();
+
+  // repeat playing all of the pitches in the pitchTab[] forever
+  // (or PLAY_COUNT times, and then sleep until the switch on PB4 wakes us up)
+  while (1) {
+    vmStart();
+    ledIndex = 0;       // start the light show from the beginning too
+    ledNotesLeft = 0;
+    setTimbre(0);       // and start with gumballWavTab[]
+#if VOICES > 1
+    for (uint8_t v=0; v<VOICES-1; v++) {
+      setVoice(v, 0);   // with voices 2 and 3 quiet
+    }
+#endif
+#if NOISE
+    setNoise(0);        // and no noise
+#endif
+#if ENVELOPE
+    envShape = 0;       // and no envelope
+#endif
+#if KARPLUS
+    setPluck(PLUCK_OFF);  // and not plucked
+#endif
+#if BYTEBEAT
+    setBeat(0);         // and not playing a bytebeat
+#endif
+#if FM
+    setFm(0);           // and no phase modulation
+#endif
+#if WINDOW
+    setWindow(0);       // and all of the wave table
+#endif
+#if ARPEGGIO
+    setArp(0);          // and no arpeggio
+#endif
+
+    // create Gumball waveform using PWM by continually sequencing through the waveform sample values in gumballWavTab[]
+    // vary the playback rate to vary the pitch of the waveform with the gumballPitch values in pitchTab[]
+    // vary the lengths of time for playing a pitch with the pitchDuration values in pitchTab[]
+    pitchRate = vmNext(&pitchLen);
+
+    // this "while" loop plays the NOTE()s and CMD()s that the score player finds in pitchTab[]
+    // each NOTE() has a pitch-rate (how fast to play back the waveform) and a pitch-length (how long to play the pitch)
+    // (at the END, vmNext() hands back CMD_END, so we keep looping until then)
+    while (pitchRate != CMD_END) {
+      if (pitchRate < PITCH_LOWEST) {
+        // this is a command, not a pitch
+        doCommand(vmCmd, pitchLen);
+      } else {
+        // hand the pitch to the Timer0 interrupt, which plays the samples of the gumball waveform from gumballWavTab[]
+        // --the playback rate (the pitch) is determined by pitchRate (which is the Pitch value from pitchTab[] )
+        // --the playback duration (how long to play this pitch) is determined by pitchLen (which is the Duration value from pitchTab[] )
+        // and make the LEDs light up in cool ways, with the next step of the light show in ledTrack[]
+        ledNextPitch();
+#if KARPLUS
+        if (ksMode != PLUCK_OFF) {
+          ksPluck();
+        }
+#endif
+#if ENVELOPE
+        envStart(pitchLen);
+#endif
+#if FM
+        if (fmOn) {
+          fmStart(pitchRate);
+        }
+#endif
+#if LFO
+        vibStart();
+#endif
+#if ARPEGGIO
+        arpStart();
+#endif
+#if PORTAMENTO
+        if (glideTo != 0) {
+          glideStart(pitchRate, pitchLen);   // (pitchLen is how many control ticks the glide takes)
+        } else
+#endif
+#if NOTE_TIME
+        noteStart(pitchRate, pitchLen);
+#else
+        playPitch(pitchRate, pitchLen);
+#endif
+      }
+
+      // get the next values of pitchRate and pitchLen from pitchTab[] while the interrupt is playing this pitch
+      pitchRate = vmNext(&pitchLen);
+
+      // sleep until the interrupt has played all of the samples for this pitch
+      // (pitchPlaying is a single byte, so we can check it without stopping the interrupt)
+      // (and fade the LEDs each control tick while we wait)
+      // (after a command pitchPlaying is already 0, so we go straight on to the next element)
+      while (pitchPlaying) {
+        sleep_mode();
+#if BYTEBEAT
+        if (beatOn) {
+          beatUpdate();
+        }
+#endif
+        if (controlTick) {
+          controlTick = 0;
+          ledUpdate();
+#if ENVELOPE
+          envUpdate();
+#endif
+#if WINDOW
+          winUpdate();
+#endif
+#if PORTAMENTO
+          glideUpdate();
+#endif
+#if NOTE_TIME
+          noteUpdate();
+#endif
+#if ARPEGGIO
+          arpUpdate();
+#endif
+#if LFO
+          vibUpdate();
+#endif
+        }
+      }
+
+    }
+
+#if PLAY_COUNT != 0
+    // go to sleep once we have played the composition PLAY_COUNT times
+    playCount++;
+    if (playCount >= PLAY_COUNT) {
+      sleepUntilButton();
+      playCount = 0;
+    }
+#endif
   }
 }
 
@@ -0,0 +1,353 @@
+#!/usr/bin/env python3
+"""
+avrbudget.py  --  works out how much of the ATtiny13a the firmware really uses,
+                  from the listing that avr-objdump makes of it (GumballSound.lss),
+                  and fails if it does not fit.
+
+Usage:
+    python3 tools/avrbudget.py GumballSound.lss
+    python3 tools/avrbudget.py GumballSound.lss --su GumballSound.su --loop-max 8 --row "-DFM=1"
+    python3 tools/avrbudget.py GumballSound.lss --su GumballSound.su --stack   (just prints the stack)
+
+The Makefile runs it after each build (see "make budget" and "make budgets").
+It reports:
+    flash   -- .text + .data, out of FLASH bytes
+    RAM     -- .data + .bss (the variables), out of RAM bytes
+    stack   -- the most the stack can grow: the deepest chain of calls from
+               main(), with an interrupt (the deepest one) on top of it -- this
+               has to fit in the RAM the variables leave
+    cycles  -- the most clock cycles the Timer0 interrupt can take, out of the
+               CYCLES clock cycles between two Timer0 overflows (this counts
+               the 4 cycles the CPU takes to answer the interrupt, 4 more to
+               wake up from Idle sleep, and the RJMP in the vector table)
+
+The cycles are counted along every path through the interrupt (and the
+functions it calls), using the cycle counts in the ATtiny13a datasheet, and
+the longest path is reported.  A loop counts as many times round as it can go:
+if its counter is loaded with LDI just before the loop, that number is used,
+otherwise --loop-max is (the firmware's loops with a counter that is not a
+constant are the shifts by fmShift, which is 8 at most, and the WAVE_DELTA
+steps, which are 2 at most).  Those loops are listed, so you can check them.
+So the figure is never less than the real worst case -- but it can be more,
+if the longest path is one the code can never really take.
+
+Each function's part of the stack is its return address, its PUSHes, and
+the room it makes for its local variables (RCALL .+0, or taking it off the
+stack pointer), or what -fstack-usage says in GumballSound.su, if that is
+more.  The calls come from the RCALLs in the listing, so the functions from
+libgcc (like __udivmodsi4) are counted too.
+"""
+
+import re
+import sys
+
+FLASH = 1024
+RAM = 64
+CYCLES = 256
+ISR_ENTRY = 4 + 4 + 2   # answer the interrupt, wake up from Idle, RJMP in the vector table
+
+# clock cycles for each instruction (ATtiny13a datasheet, "Instruction Set Summary")
+# (branches and skips take more when they jump -- see step())
+CYCLE_TAB = {}
+for _m in ('add adc sub subi sbc sbci and andi or ori eor com neg sbr cbr inc dec tst clr ser '
+           'cp cpc cpi mov movw ldi in out lsl lsr rol ror asr swap bset bclr bst bld '
+           'sec clc sen cln sez clz sei cli ses cls sev clv set clt seh clh nop sleep wdr').split():
+    CYCLE_TAB[_m] = 1
+for _m in 'adiw sbiw rjmp ijmp ld ldd st std lds sts push pop sbi cbi'.split():
+    CYCLE_TAB[_m] = 2
+for _m in 'rcall icall lpm'.split():
+    CYCLE_TAB[_m] = 3
+for _m in 'ret reti'.split():
+    CYCLE_TAB[_m] = 4
+SKIPS = ('cpse', 'sbrc', 'sbrs', 'sbic', 'sbis')
+
+LABEL_RE = re.compile(r'^([0-9a-f]{4,8}) <([^>]+)>:\s*$')
+INSN_RE = re.compile(r'^\s*([0-9a-f]+):\s+((?:[0-9a-f]{2} )+)\s*([a-z]+)\b\s*([^;]*)')
+SECTION_RE = re.compile(r'^\s*\d+\s+(\.\S+)\s+([0-9a-f]{8})\s')
+REL_RE = re.compile(r'\.([+-]\d+)')
+
+
+class Insn(object):
+    def __init__(self, addr, size, mnem, ops):
+        self.addr = addr
+        self.size = size
+        self.mnem = mnem
+        self.ops = [o.strip() for o in ops.split(',')] if ops.strip() else []
+        self.target = None
+        m = REL_RE.search(ops)
+        if m and (mnem in ('rjmp', 'rcall') or mnem.startswith('br')):
+            self.target = addr + 2 + int(m.group(1))
+
+
+def read_listing(path):
+    # the instructions (by address), the functions (name -> first address), and the section sizes
+    insns = {}
+    funcs = {}
+    sections = {}
+    for line in open(path):
+        m = SECTION_RE.match(line)
+        if m:
+            sections[m.group(1)] = int(m.group(2), 16)
+            continue
+        m = LABEL_RE.match(line)
+        if m:
+            funcs[m.group(2)] = int(m.group(1), 16)
+            continue
+        m = INSN_RE.match(line)
+        if m:
+            addr = int(m.group(1), 16)
+            insns[addr] = Insn(addr, len(m.group(2).split()), m.group(3), m.group(4))
+    return insns, funcs, sections
+
+
+class Budget(object):
+    def __init__(self, insns, funcs, loop_max):
+        self.insns = insns
+        self.funcs = funcs
+        self.loop_max = loop_max
+        self.starts = sorted(set(funcs.values()))
+        self.names = dict((a, n) for n, a in funcs.items())
+        self.cycles_done = {}
+        self.stack_done = {}
+        self.su = {}        # function name -> bytes, from -fstack-usage
+        self.guessed = []   # (function, address) of loops that used --loop-max
+
+    def func_range(self, start):
+        later = [a for a in self.starts if a > start]
+        end = later[0] if later else max(self.insns) + 2
+        return start, end
+
+    def name(self, addr):
+        return self.names.get(addr, '0x%x' % addr)
+
+    #--------------------
+    # cycles
+
+    def step(self, insn, lo, hi):
+        # the ways on from insn: (address, extra cycles if it goes that way), and the
+        # cycles of the function it calls or jumps to (there are no ways on from RET/RETI)
+        m = insn.mnem
+        nxt = insn.addr + insn.size
+        if m in ('ret', 'reti'):
+            return [], 0
+        if m in ('ijmp', 'icall', 'eijmp', 'eicall'):
+            sys.exit('%s at 0x%x: a computed jump or call, which this cannot follow' % (m, insn.addr))
+        if m == 'rjmp':
+            if lo <= insn.target < hi:
+                return [(insn.target, 0)], 0
+            return [], self.cycles(insn.target)   # a jump to another function (a "tail call")
+        if m == 'rcall':
+            if insn.target == nxt:
+                return [(nxt, 0)], 0              # RCALL .+0 just makes room on the stack
+            return [(nxt, 0)], self.cycles(insn.target)
+        if m.startswith('br'):
+            return [(nxt, 0), (insn.target, 1)], 0
+        if m in SKIPS:
+            after = self.insns[nxt]
+            return [(nxt, 0), (nxt + after.size, after.size // 2)], 0
+        return [(nxt, 0)], 0
+
+    def longest(self, lo, hi, start, stop, extra, loops=()):
+        # the longest path from start, going forwards only, through [lo, hi):
+        # to the end of the function (stop None), or to the branch at stop
+        # (extra has the cycles of going round each loop again, on its branch back)
+        dist = {start: 0}
+        best = None
+        for addr in sorted(a for a in self.insns if start <= a < hi):
+            if addr not in dist:
+                continue
+            insn = self.insns[addr]
+            if insn.mnem not in CYCLE_TAB and insn.mnem not in SKIPS and not insn.mnem.startswith('br'):
+                sys.exit("I don't know how many cycles '%s' at 0x%x takes" % (insn.mnem, addr))
+            here = dist[addr] + CYCLE_TAB.get(insn.mnem, 1) + extra.get(addr, 0)
+            if addr == stop:
+                return here
+            nexts, called = self.step(insn, lo, hi)
+            here += called
+            if not nexts and stop is None:
+                best = max(best, here) if best is not None else here
+            for to, more in nexts:
+                if to <= addr:
+                    if stop is None and addr not in loops:
+                        # jumping back to code that is not a loop (like a shared ending)
+                        tail = self.longest(lo, hi, to, None, extra, loops)
+                        best = max(best, here + more + tail) if best is not None else here + more + tail
+                    continue
+                if to < hi:
+                    dist[to] = max(dist.get(to, 0), here + more)
+        return best
+
+    def loop_bound(self, head, branch, lo):
+        # how many more times round the loop can go: read it from "LDI rN, k ... DEC rN; BRxx head"
+        addrs = sorted(a for a in self.insns if lo <= a < branch)
+        before = [self.insns[a] for a in addrs if a < branch][-1:]
+        if before and before[0].mnem in ('dec', 'subi') and before[0].ops:
+            reg = before[0].ops[0]
+            if before[0].mnem == 'subi' and before[0].ops[1:] not in (['0x01'], ['1']):
+                reg = None
+            if reg:
+                for a in reversed([a for a in addrs if a < head][-10:]):
+                    insn = self.insns[a]
+                    if insn.ops and insn.ops[0] == reg:
+                        if insn.mnem == 'ldi':
+                            k = int(insn.ops[1], 0) & 0xff
+                            return k if k else 256
+                        break
+        return None
+
+    def cycles(self, start):
+        # the most cycles the function at start can take, with its RET
+        if start in self.cycles_done:
+            if self.cycles_done[start] is None:
+                sys.exit('%s calls itself, so its cycles cannot be counted' % self.name(start))
+            return self.cycles_done[start]
+        self.cycles_done[start] = None
+        lo, hi = self.func_range(start)
+        # the loops: a branch back to an earlier address, innermost (shortest) first
+        loops = []
+        for a in sorted(x for x in self.insns if lo <= x < hi):
+            insn = self.insns[a]
+            if insn.target is not None and insn.mnem != 'rcall' and lo <= insn.target <= a:
+                loops.append((a - insn.target, insn.target, a))
+        extra = {}
+        branches = set()
+        for _, head, branch in sorted(loops):
+            once = self.longest(lo, hi, head, branch, extra)
+            if once is None:
+                continue        # not really a loop (it never gets back to the branch)
+            branches.add(branch)
+            k = self.loop_bound(head, branch, lo)
+            if k is None:
+                k = self.loop_max
+                self.guessed.append((self.name(start), head))
+            # each time round again is the way from the head to the branch, and the branch back
+            # (counted on the branch, since avr-gcc often jumps into the middle of a loop the first time)
+            extra[branch] = k * (once + 1)
+        result = self.longest(lo, hi, start, None, extra, branches)
+        if result is None:
+            sys.exit('%s never returns' % self.name(start))
+        self.cycles_done[start] = result
+        return result
+
+
+    #--------------------
+    # stack
+
+    def callees(self, start):
+        lo, hi = self.func_range(start)
+        out = set()
+        for a in sorted(x for x in self.insns if lo <= x < hi):
+            insn = self.insns[a]
+            if insn.mnem in ('icall', 'ijmp', 'eicall', 'eijmp'):
+                sys.exit('%s at 0x%x: a computed jump or call, which this cannot follow' % (insn.mnem, a))
+            if insn.mnem == 'rcall' and insn.target != a + 2:
+                out.add(insn.target)
+            elif insn.mnem in ('rjmp',) or insn.mnem.startswith('br'):
+                if not lo <= insn.target < hi:
+                    out.add(insn.target)   # a jump to another function (a "tail call")
+        return out
+
+    def frame(self, start):
+        # the bytes the function itself puts on the stack
+        lo, hi = self.func_range(start)
+        size = 2            # the return address
+        prev = None
+        for a in sorted(x for x in self.insns if lo <= x < hi):
+            insn = self.insns[a]
+            if insn.mnem == 'push':
+                size += 1
+            elif insn.mnem == 'rcall' and insn.target == a + 2:
+                size += 2       # RCALL .+0 makes room for 2 bytes
+            elif (prev is not None and prev.mnem == 'in' and prev.ops[:1] == ['r28'] and
+                  insn.mnem in ('subi', 'sbiw') and insn.ops[:1] == ['r28']):
+                size += int(insn.ops[1], 0) & 0xff   # IN r28, SP then take the local variables off it
+            prev = insn
+        return max(size, self.su.get(self.name(start), 0))
+
+    def stack(self, start):
+        # the most the stack grows from calling the function at start
+        if start in self.stack_done:
+            if self.stack_done[start] is None:
+                sys.exit('%s calls itself, so its stack cannot be counted' % self.name(start))
+            return self.stack_done[start]
+        self.stack_done[start] = None
+        deepest = max([self.stack(c) for c in self.callees(start)] or [0])
+        self.stack_done[start] = self.frame(start) + deepest
+        return self.stack_done[start]
+
+
+def read_su(path):
+    # "GumballSound.c:1234:6:vibUpdate<tab>8<tab>static" -> {'vibUpdate': 8}
+    out = {}
+    for line in open(path):
+        parts = line.rstrip('\n').split('\t')
+        if len(parts) >= 2 and parts[1].isdigit():
+            out[parts[0].split(':')[-1]] = int(parts[1])
+    return out
+
+
+def main():
+    args = sys.argv[1:]
+    opts = {'--loop-max': '8', '--isr': '__vector_3', '--row': None, '--su': None}
+    files = []
+    stack_only = False
+    while args:
+        a = args.pop(0)
+        if a == '--stack':
+            stack_only = True
+        elif a in opts:
+            opts[a] = args.pop(0)
+        else:
+            files.append(a)
+    if len(files) != 1:
+        sys.exit(__doc__)
+    insns, funcs, sections = read_listing(files[0])
+    if opts['--isr'] not in funcs:
+        sys.exit("can't find %s (the Timer0 interrupt) in %s" % (opts['--isr'], files[0]))
+    b = Budget(insns, funcs, int(opts['--loop-max']))
+    if opts['--su']:
+        b.su = read_su(opts['--su'])
+    if 'main' not in funcs:
+        sys.exit("can't find main() in %s" % files[0])
+    main_stack = b.stack(funcs['main'])
+    isr_stack = max(b.stack(a) for n, a in funcs.items() if re.match(r'__vector_\d+$', n))
+    if stack_only:
+        print(main_stack + isr_stack)
+        return
+
+    flash = sections.get('.text', 0) + sections.get('.data', 0)
+    ram = sections.get('.data', 0) + sections.get('.bss', 0) + sections.get('.noinit', 0)
+    cycles = ISR_ENTRY + b.cycles(funcs[opts['--isr']])
+    free = RAM - ram
+
+    problems = []
+    if flash > FLASH:
+        problems.append('flash: %d bytes is more than %d' % (flash, FLASH))
+    if ram > RAM:
+        problems.append('RAM: %d bytes is more than %d' % (ram, RAM))
+    elif main_stack + isr_stack > free:
+        problems.append('the stack can need %d bytes, but the variables only leave %d' % (main_stack + isr_stack, free))
+    if cycles > CYCLES:
+        problems.append('the Timer0 interrupt can take %d clock cycles, but it only has %d' % (cycles, CYCLES))
+
+    if opts['--row'] is not None:
+        print('%-50s %5d %4d %5d %6d%s' % (opts['--row'] or '(default)', flash, ram,
+                                           main_stack + isr_stack, cycles,
+                                           '   <-- too much' if problems else ''))
+        return
+    print('flash:  %4d of %d bytes' % (flash, FLASH))
+    print('RAM:    %4d of %d bytes (the variables)' % (ram, RAM))
+    print('stack:  %4d of the %d bytes left (%d for main() and what it calls, %d for an interrupt on top)'
+          % (main_stack + isr_stack, free, main_stack, isr_stack))
+    print('Timer0 interrupt: %d of %d clock cycles, at the most' % (cycles, CYCLES))
+    for name, head in b.guessed:
+        print('  (the loop at 0x%x in %s is counted %s times round -- see --loop-max)'
+              % (head, name, opts['--loop-max']))
+    for p in problems:
+        print('Too much! ' + p)
+    if problems:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,379 @@
+#!/usr/bin/env python3
+"""
+scoreasm.py  --  assembles a score (like score.txt) into pitchTab[], the little
+                 program that the score player in GumballSound.c plays, and
+                 reports how many bytes of flash it saved.
+
+Usage:
+    python3 tools/scoreasm.py              (reads score.txt)
+    python3 tools/scoreasm.py myScore.txt
+    python3 tools/scoreasm.py --ticks myScore.txt
+                                           (the DURATIONs are score ticks, for NOTE_TIME=1)
+    python3 tools/scoreasm.py --to-ticks [BPM] score.txt
+                                           (the DURATIONs are samples, but turn them into
+                                            score ticks at BPM beats a minute, so the score
+                                            plays just as long with NOTE_TIME=1)
+
+Without --ticks or --to-ticks, a DURATION counts wave table samples (like
+score.txt), so the note is shorter for a higher pitch.  With NOTE_TIME=1 the
+firmware counts it in score ticks instead (24 to a beat), so pitchTab[] says
+which one it was made with (PITCH_TAB_TICKS), and GumballSound.c will not
+build if that does not match NOTE_TIME.  --to-ticks works out how long each
+note really plays for (DURATION * PITCH / PITCH_UNIT_HZ seconds) and turns
+that into score ticks.  A faster BPM keeps the short notes closer to their
+length, since there are more ticks each second (the default is TEMPO_BPM, and
+600 is the most).
+
+It prints the pitchTab[] table (ready to paste into GumballSound.c).  The
+report compares it with a flat table of 3 bytes for each note and command it
+plays (with every CALL and REPEAT written out in full), which is how
+pitchTab[] used to be stored, and says how much of that was saved by the
+smaller steps (a NOTE() is 2 bytes now), and how much by the phrases.  It
+also says how much the note lengths were rounded to fit in 1 byte (see
+NOTE_LEN in GumballSound.c).
+
+A score has one step on each line (anything after a # is a comment):
+    name:                  -- a label, so CALL, REPEAT, and JUMP can find this place
+    note PITCH DURATION    -- play a pitch (PITCH is a gumballPitch, 10 to 255)
+                              (a DURATION over 4063 is made into a longnote by itself)
+    longnote PITCH DURATION -- the same, but the DURATION is not rounded (it takes 4 bytes)
+    glide FROM TO TICKS    -- slide from pitch FROM to pitch TO, taking TICKS control ticks
+                              (the firmware needs PORTAMENTO=1 for this)
+    tempo BPM              -- play the notes after this at BPM beats a minute
+                              (this needs --ticks, and the firmware needs NOTE_TIME=1 -- then
+                              a DURATION is in score ticks, 24 to a beat, instead of samples)
+    vibrato DEPTH RATE     -- wobble the pitch of the notes after this (DEPTH and RATE are 0 to 15,
+                              "vibrato 0 0" stops it) (the firmware needs LFO=1 for this)
+    timbre N               -- a command (also voice2, voice3, noise, env, pluck, beat,
+    noise NOISE_SET(...)      fm, window, and arp) -- the value is copied into the C table
+                              as it is, so it can use the macros in GumballSound.c
+    call NAME              -- play the phrase at label NAME (it must end with ret)
+    repeat N NAME          -- play the phrase at label NAME, N times
+    ret                    -- the end of a phrase
+    jump NAME              -- go on from label NAME
+    end                    -- the end of the composition
+"""
+
+import sys
+
+PITCH_LOWEST = 10
+VM_DEPTH = 2        # how deep phrases can CALL each other (VM_DEPTH in GumballSound.c)
+VM_MAX_STEPS = 8    # how many CALLs, RETs, etc. the player will do between notes (VM_MAX_STEPS)
+NOTE_LONGEST = 4063 # the longest DURATION a 2-byte note can keep (NOTE_LONGEST)
+PITCH_UNIT_HZ = 9600000 // 165  # units of gumballPitch per second (PITCH_UNIT_HZ)
+TEMPO_BPM = 120     # the tempo the composition starts at (TEMPO_BPM)
+TICKS_PER_BEAT = 24 # score ticks in each beat (TICKS_PER_BEAT)
+
+COMMANDS = {
+    'timbre': 'CMD_TIMBRE', 'voice2': 'CMD_VOICE2', 'voice3': 'CMD_VOICE3',
+    'noise': 'CMD_NOISE', 'env': 'CMD_ENV', 'pluck': 'CMD_PLUCK',
+    'beat': 'CMD_BEAT', 'fm': 'CMD_FM', 'window': 'CMD_WINDOW',
+    'arp': 'CMD_ARP',
+}
+SIZES = {'note': 2, 'longnote': 4, 'glide': 5, 'tempo': 3, 'vibrato': 2, 'cmd': 4, 'call': 2, 'repeat': 3, 'ret': 1, 'jump': 2, 'end': 1}
+
+
+def fail(lineno, msg):
+    sys.exit('line %d: %s' % (lineno, msg))
+
+
+def parse(path):
+    steps = []      # (lineno, op, args)
+    labels = {}     # name -> index into steps
+    for lineno, line in enumerate(open(path), 1):
+        line = line.split('#', 1)[0].strip()
+        if not line:
+            continue
+        if line.endswith(':'):
+            name = line[:-1].strip()
+            if name in labels:
+                fail(lineno, 'label %s is already used' % name)
+            labels[name] = len(steps)
+            continue
+        words = line.split(None, 1)
+        op = words[0].lower()
+        rest = words[1].strip() if len(words) > 1 else ''
+        if op in COMMANDS:
+            if not rest:
+                fail(lineno, '%s needs a value' % op)
+            steps.append((lineno, 'cmd', (COMMANDS[op], rest)))
+        elif op in ('note', 'longnote'):
+            try:
+                pitch, duration = [int(v, 0) for v in rest.split()]
+            except ValueError:
+                fail(lineno, '%s needs a pitch and a duration' % op)
+            if not PITCH_LOWEST <= pitch <= 255:
+                fail(lineno, 'the pitch must be between %d and 255' % PITCH_LOWEST)
+            if not 0 <= duration <= 65535:
+                fail(lineno, 'the duration must be between 0 and 65535')
+            if duration > NOTE_LONGEST:
+                op = 'longnote'
+            steps.append((lineno, op, (pitch, duration)))
+        elif op == 'glide':
+            try:
+                start, end, ticks = [int(v, 0) for v in rest.split()]
+            except ValueError:
+                fail(lineno, 'glide needs two pitches and a number of ticks')
+            if not (PITCH_LOWEST <= start <= 255 and PITCH_LOWEST <= end <= 255):
+                fail(lineno, 'the pitches must be between %d and 255' % PITCH_LOWEST)
+            if not 1 <= ticks <= 65535:
+                fail(lineno, 'the ticks must be between 1 and 65535')
+            steps.append((lineno, 'glide', (start, end, ticks)))
+        elif op == 'tempo':
+            try:
+                bpm = int(rest, 0)
+            except ValueError:
+                fail(lineno, 'tempo needs a number of beats a minute')
+            if not 1 <= bpm <= 600:
+                fail(lineno, 'the tempo must be between 1 and 600 beats a minute')
+            steps.append((lineno, op, (bpm,)))
+        elif op == 'vibrato':
+            try:
+                depth, rate = [int(v, 0) for v in rest.split()]
+            except ValueError:
+                fail(lineno, 'vibrato needs a depth and a rate')
+            if not (0 <= depth <= 15 and 0 <= rate <= 15):
+                fail(lineno, 'the depth and the rate must be between 0 and 15')
+            steps.append((lineno, op, (depth, rate)))
+        elif op in ('call', 'jump'):
+            steps.append((lineno, op, (rest,)))
+        elif op == 'repeat':
+            try:
+                n, name = rest.split()
+                n = int(n, 0)
+            except ValueError:
+                fail(lineno, 'repeat needs a count and a label')
+            if not 1 <= n <= 255:
+                fail(lineno, 'the repeat count must be between 1 and 255')
+            steps.append((lineno, op, (n, name)))
+        elif op in ('ret', 'end'):
+            steps.append((lineno, op, ()))
+        else:
+            fail(lineno, "I don't know '%s'" % op)
+    return steps, labels
+
+
+def place(steps, labels):
+    # work out the byte number of each step (and of each label)
+    at = []
+    size = 0
+    for _, op, _ in steps:
+        at.append(size)
+        size += SIZES[op]
+    at.append(size)
+    where = {name: at[i] for name, i in labels.items()}
+    for lineno, op, args in steps:
+        if op in ('call', 'jump', 'repeat') and args[-1] not in where:
+            fail(lineno, "there is no label '%s'" % args[-1])
+    if size > 256:
+        sys.exit('pitchTab[] is %d bytes, but the score player can only reach 256' % size)
+    return at, where
+
+
+def note_shift(d):
+    # NOTE_SHIFT() in GumballSound.c
+    for shift, below in enumerate((64, 128, 256, 512, 1024, 2048)):
+        if d < below:
+            return shift
+    return 6
+
+
+def note_len(d):
+    # the byte that NOTE_LEN() in GumballSound.c makes for a duration
+    shift = note_shift(d)
+    return (shift << 5) + ((d + ((1 << shift) >> 1)) >> shift)
+
+
+def note_length(code):
+    # the duration the firmware plays for that byte (noteLength() in GumballSound.c)
+    shift = code >> 5
+    if shift < 2:
+        return code
+    return ((code & 0x1f) | 0x20) << (shift - 1)
+
+
+def walk(steps, labels):
+    # play the score the way the score player does, and count what it plays
+    # (and how many bytes it would take written out in full, with no phrases)
+    index = {name: i for name, i in labels.items()}
+    i = 0
+    stack = []
+    played = 0
+    unrolled = SIZES['end']
+    flow = 0
+    while played < 100000:
+        if i >= len(steps):
+            sys.exit('the score runs off the end (it needs an "end")')
+        lineno, op, args = steps[i]
+        if op in ('note', 'longnote', 'glide', 'cmd'):
+            played += 1
+            unrolled += SIZES[op]
+            flow = 0
+            i += 1
+            continue
+        if op == 'end':
+            return played, unrolled
+        flow += 1
+        if flow > VM_MAX_STEPS:
+            fail(lineno, 'more than %d calls, rets, jumps, tempos, and vibratos in a row (the player stops there)' % VM_MAX_STEPS)
+        if op in ('tempo', 'vibrato'):
+            unrolled += SIZES[op]
+            i += 1
+            continue
+        if op in ('call', 'repeat'):
+            if len(stack) >= VM_DEPTH:
+                fail(lineno, 'phrases can only call each other %d deep' % VM_DEPTH)
+            n = args[0] if op == 'repeat' else 1
+            stack.append([i + 1, n - 1, index[args[-1]]])
+            i = index[args[-1]]
+        elif op == 'ret':
+            if not stack:
+                fail(lineno, 'ret without a call')
+            if stack[-1][1] > 0:
+                stack[-1][1] -= 1
+                i = stack[-1][2]
+            else:
+                i = stack.pop()[0]
+        elif op == 'jump':
+            i = index[args[0]]
+    return None, None   # it goes round forever
+
+
+def to_ticks(steps, labels, bpm):
+    # turn the DURATIONs from samples into score ticks at bpm beats a minute
+    # (and start with a tempo, if it is not the one the firmware starts at)
+    ticks_per_sec = bpm * TICKS_PER_BEAT / 60.0
+    out = []
+    short = 0
+    off = (0.0, 0)
+    was = now = 0.0
+    for lineno, op, args in steps:
+        if op == 'tempo':
+            fail(lineno, 'tempo cannot be used with --to-ticks (the DURATIONs are in samples)')
+        if op in ('note', 'longnote'):
+            pitch, duration = args
+            secs = duration * pitch / float(PITCH_UNIT_HZ)
+            ticks = int(secs * ticks_per_sec + 0.5)
+            if duration and ticks == 0:
+                ticks = 1
+                short += 1
+            op = 'longnote' if ticks > NOTE_LONGEST else 'note'
+            played = note_length(note_len(ticks)) if op == 'note' else ticks
+            if secs:
+                off = max(off, (abs(played / ticks_per_sec - secs) * 1000.0, lineno))
+            was += secs
+            now += played / ticks_per_sec
+            args = (pitch, ticks)
+        out.append((lineno, op, args))
+    if bpm != TEMPO_BPM:
+        out.insert(0, (0, 'tempo', (bpm,)))
+        labels = {name: i + 1 for name, i in labels.items()}
+    return out, labels, short, off, (was, now)
+
+
+def c_step(op, args, where):
+    if op == 'note':
+        return 'NOTE(%d, %d)' % args
+    if op == 'longnote':
+        return 'LONGNOTE(%d, %d)' % args
+    if op == 'glide':
+        return 'GLIDE(%d, %d, %d)' % args
+    if op == 'cmd':
+        return 'CMD(%s, %s)' % args
+    if op == 'call':
+        return 'CALL(%d)' % where[args[0]]
+    if op == 'repeat':
+        return 'REPEAT(%d, %d)' % (args[0], where[args[1]])
+    if op == 'jump':
+        return 'JUMP(%d)' % where[args[0]]
+    if op == 'tempo':
+        return 'TEMPO(%d)' % args
+    if op == 'vibrato':
+        return 'VIBRATO(%d, %d)' % args
+    return op.upper()
+
+
+def main():
+    args = sys.argv[1:]
+    ticks = False
+    bpm = None
+    path = 'score.txt'
+    while args:
+        a = args.pop(0)
+        if a == '--ticks':
+            ticks = True
+        elif a == '--to-ticks':
+            ticks = True
+            bpm = TEMPO_BPM
+            if args and args[0].isdigit():
+                bpm = int(args.pop(0))
+                if not 1 <= bpm <= 600:
+                    sys.exit('the tempo must be between 1 and 600 beats a minute')
+        else:
+            path = a
+    steps, labels = parse(path)
+    if not ticks:
+        for lineno, op, _ in steps:
+            if op == 'tempo':
+                fail(lineno, 'tempo needs --ticks (the DURATIONs have to be in score ticks)')
+    if bpm is not None:
+        steps, labels, short, off, secs = to_ticks(steps, labels, bpm)
+    at, where = place(steps, labels)
+    played, unrolled = walk(steps, labels)
+    names = {}
+    for name, i in labels.items():
+        names.setdefault(i, []).append(name)
+
+    lines = []
+    row = []
+    for i, (_, op, args) in enumerate(steps):
+        if i in names:
+            if row:
+                lines.append('  ' + ', '.join(row) + ',')
+                row = []
+            lines.append('  // %s (byte %d)' % (', '.join(names[i]), at[i]))
+        row.append(c_step(op, args, where))
+        if len(row) == 5 or op in ('ret', 'jump', 'end'):
+            lines.append('  ' + ', '.join(row) + ',')
+            row = []
+    if row:
+        lines.append('  ' + ', '.join(row) + ',')
+    lines[-1] = lines[-1].rstrip(',')
+
+    size = at[-1]
+    if bpm is not None:
+        print('// made by tools/scoreasm.py --to-ticks %d from %s' % (bpm, path))
+    else:
+        print('// made by tools/scoreasm.py %sfrom %s' % ('--ticks ' if ticks else '', path))
+    if played is None:
+        print('// pitchTab[]: %d bytes (it plays forever, so it cannot be stored as a flat table)' % size)
+    else:
+        flat = 3 * played + 3
+        print('// pitchTab[]: %d bytes (the %d notes and commands it plays would take %d bytes as a flat table), %d bytes saved'
+              % (size, played, flat, flat - size))
+        phrases = unrolled - size
+        print('// (%d saved by the smaller steps, like the 2-byte NOTE(), and %d %s by the phrases)'
+              % (flat - unrolled, abs(phrases), 'saved' if phrases >= 0 else 'lost'))
+        if any(op == 'glide' for _, op, _ in steps):
+            print('// (each glide is counted as one flat record, but a flat table needs one for every step of a sweep)')
+    rounded = [(abs(note_length(note_len(a[1])) - a[1]) * 100.0 / a[1], a[1]) for _, op, a in steps
+               if op == 'note' and a[1] and note_length(note_len(a[1])) != a[1]]
+    if rounded:
+        worst = max(rounded)
+        print('// %d note lengths are rounded to fit in 1 byte (the most is %d, by %.1f%%)'
+              % (len(rounded), worst[1], worst[0]))
+    if bpm is not None:
+        print('// the lengths are in score ticks at %d beats a minute (the most a note is out is %.1f ms, on line %d)'
+              % (bpm, off[0], off[1]))
+        print('// (each note counted once, they add up to %.2f seconds, and they were %.2f seconds in samples)'
+              % secs[::-1])
+        if short:
+            print('// (%d notes are shorter than one tick, so they play for one tick)' % short)
+    print('#define PITCH_TAB_TICKS  %d   // 1 if the lengths are in score ticks (for NOTE_TIME=1)' % ticks)
+    print('const uint8_t pitchTab[] PROGMEM = {')
+    print('\n'.join(lines))
+    print('};')
+
+
+if __name__ == '__main__':
+    main()
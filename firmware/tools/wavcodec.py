@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+wavcodec.py  --  encodes a wave table from GumballSound.c into the compressed
+                 formats the firmware can play (see WAVE_FORMAT in GumballSound.c),
+                 and reports how far each one is from the original samples.
+
+Usage:
+    python3 tools/wavcodec.py                      (reads gumballWavTab[] from GumballSound.c)
+    python3 tools/wavcodec.py GumballSound.c myWavTab
+
+It prints a C table for each format (ready to paste into GumballSound.c),
+followed by the error report.  The error is worked out by decoding each table
+exactly the way the firmware does, and comparing it with the original samples:
+    rms  -- root-mean-square error (in 8-bit sample steps)
+    max  -- the biggest error on any one sample
+    snr  -- the signal-to-noise ratio of the decoded table (bigger is better)
+
+The formats are:
+    raw     -- 1 byte per sample (no compression)
+    pack4   -- 4 bits per sample, 2 samples per byte (nibble n plays as n*17)
+    delta   -- 4 bits per sample, each one picks a step (from a 16-step table) to add
+               to the sample before it (the additions wrap round, just like uint8_t)
+    mirror  -- only the first half of the table is stored, the second half plays it backwards
+"""
+
+import math
+import re
+import sys
+
+
+def read_table(path, name):
+    src = open(path).read()
+    m = re.search(r'\b' + re.escape(name) + r'\s*\[\s*\]\s*PROGMEM\s*=\s*\{([^}]*)\}', src)
+    if not m:
+        sys.exit("can't find %s[] in %s" % (name, path))
+    return [int(v, 0) for v in re.findall(r'0x[0-9a-fA-F]+|\d+', m.group(1))]
+
+
+def c_table(ctype, name, values, comment):
+    lines = ['// %s' % comment, 'const %s %s[] PROGMEM = {' % (ctype, name)]
+    for i in range(0, len(values), 12):
+        row = values[i:i + 12]
+        if ctype == 'int8_t':
+            lines.append('  ' + ', '.join('%4d' % v for v in row) + ',')
+        else:
+            lines.append('  ' + ', '.join('0x%02x' % v for v in row) + ',')
+    lines[-1] = lines[-1].rstrip(',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def pack_nibbles(codes):
+    # sample i is in byte i/2: the low nibble for even i, the high nibble for odd i
+    if len(codes) % 2:
+        codes = codes + [0]
+    return [codes[i] | (codes[i + 1] << 4) for i in range(0, len(codes), 2)]
+
+
+#--------------------
+# pack4
+
+def encode_pack4(wav):
+    codes = [min(15, int(round(v / 17.0))) for v in wav]
+    return pack_nibbles(codes)
+
+
+def decode_pack4(packed, n):
+    out = []
+    for i in range(n):
+        b = packed[i >> 1]
+        nib = (b >> 4) if (i & 1) else (b & 0x0f)
+        out.append(nib | (nib << 4))
+    return out
+
+
+#--------------------
+# delta
+
+def delta_encode_with(wav, steps):
+    # closed-loop: each code is chosen from what the decoder will really have,
+    # so the error never builds up
+    acc = wav[0]
+    codes = []
+    for target in wav[1:]:
+        best = min(range(16), key=lambda c: abs(((acc + steps[c]) & 0xff) - target))
+        codes.append(best)
+        acc = (acc + steps[best]) & 0xff
+    return codes
+
+
+def decode_delta(start, steps, packed, n):
+    out = [start]
+    acc = start
+    for i in range(1, n):
+        b = packed[(i - 1) >> 1]
+        code = (b >> 4) if ((i - 1) & 1) else (b & 0x0f)
+        acc = (acc + steps[code]) & 0xff
+        out.append(acc)
+    return out
+
+
+def encode_delta(wav):
+    # start with steps spread evenly over the (wrapped) sample-to-sample changes,
+    # then improve them a few times (like k-means) using the closed-loop changes
+    diffs = sorted(((wav[i] - wav[i - 1] + 128) & 0xff) - 128 for i in range(1, len(wav)))
+    steps = [diffs[min(len(diffs) - 1, (2 * k + 1) * len(diffs) // 32)] for k in range(16)]
+    best = None
+    for _ in range(20):
+        codes = delta_encode_with(wav, steps)
+        packed = pack_nibbles(codes)
+        err = rms(wav, decode_delta(wav[0], steps, packed, len(wav)))
+        if best is None or err < best[0]:
+            best = (err, list(steps), packed)
+        # move each step to the average change it was used for
+        acc = wav[0]
+        used = [[] for _ in range(16)]
+        for c, target in zip(codes, wav[1:]):
+            used[c].append(((target - acc + 128) & 0xff) - 128)
+            acc = (acc + steps[c]) & 0xff
+        steps = [int(round(sum(u) / len(u))) if u else s for u, s in zip(used, steps)]
+        steps = [max(-128, min(127, s)) for s in steps]
+    return best[1], best[2]
+
+
+#--------------------
+# mirror
+
+def encode_mirror(wav):
+    # each stored sample plays twice (forwards, then backwards), so store the
+    # average of the two samples it stands for
+    n = len(wav)
+    half = (n + 1) // 2
+    return [int(round((wav[i] + wav[n - 1 - i]) / 2.0)) for i in range(half)]
+
+
+def decode_mirror(half, n):
+    return [half[i] if i < len(half) else half[n - 1 - i] for i in range(n)]
+
+
+#--------------------
+
+def rms(a, b):
+    return math.sqrt(sum((x - y) ** 2 for x, y in zip(a, b)) / len(a))
+
+
+def report(name, wav, dec, nbytes):
+    e = rms(wav, dec)
+    mean = sum(wav) / float(len(wav))
+    sig = math.sqrt(sum((v - mean) ** 2 for v in wav) / len(wav))
+    snr = 20 * math.log10(sig / e) if e else float('inf')
+    mx = max(abs(x - y) for x, y in zip(wav, dec))
+    print('//   %-7s %3d bytes   rms %6.2f   max %3d   snr %5.1f dB' % (name, nbytes, e, mx, snr))
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else 'GumballSound.c'
+    name = sys.argv[2] if len(sys.argv) > 2 else 'gumballWavTab'
+    wav = read_table(path, name)
+    n = len(wav)
+
+    pack4 = encode_pack4(wav)
+    steps, delta = encode_delta(wav)
+    mirror = encode_mirror(wav)
+
+    print(c_table('uint8_t', name + '4', pack4, 'WAVE_PACK4: %d samples, 2 per byte (made by tools/wavcodec.py)' % n))
+    print()
+    print('const uint8_t %sStart = 0x%02x;  // WAVE_DELTA: the first sample' % (name, wav[0]))
+    print(c_table('int8_t', name + 'Steps', steps, 'WAVE_DELTA: the 16 steps a delta code can pick (made by tools/wavcodec.py)'))
+    print(c_table('uint8_t', name + 'Delta', delta, 'WAVE_DELTA: %d delta codes, 2 per byte (made by tools/wavcodec.py)' % (n - 1)))
+    print()
+    print(c_table('uint8_t', name + 'Half', mirror, 'WAVE_MIRROR: the first half of %d samples (made by tools/wavcodec.py)' % n))
+    print()
+    print('// %s[] (%d samples), decoded and compared with the original:' % (name, n))
+    report('raw', wav, wav, n)
+    report('pack4', wav, decode_pack4(pack4, n), len(pack4))
+    report('delta', wav, decode_delta(wav[0], steps, delta, n), len(delta) + len(steps) + 1)
+    report('mirror', wav, decode_mirror(mirror, n), len(mirror))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""
+wavmip.py  --  makes the shorter, smoother copies of the wave tables that
+               GumballSound.c plays for very high pitches (see MIPMAP in
+               GumballSound.c), and reports how much of each table they keep.
+
+Usage:
+    python3 tools/wavmip.py                  (reads the wave tables in wavBank[] from GumballSound.c)
+    python3 tools/wavmip.py GumballSound.c 2 (makes 2 levels instead of 1)
+
+Each level is half as long as the one before it.  A wave table with N
+samples can only hold harmonics up to N/2, so before the table is made
+shorter, the harmonics that will not fit any more are taken out (with a
+Fourier transform), and the smooth waveform that is left is sampled at the
+new length.  That way a level never has anything in it that could alias.
+
+It prints the tables and the wavMip[] list (ready to paste into
+GumballSound.c), followed by the report:
+    kept  -- how much of the table's sound (not counting its average) is still there
+If a level would keep less than half of the sound, it is not made (its place
+in wavMip[] is 0), and the firmware keeps playing the level before it: some
+waveforms (like gumballWavTab[]) are nearly all high harmonics, and they
+would just go quiet.
+"""
+
+import math
+import sys
+
+from wavcodec import read_table
+
+TABLES = ['gumballWavTab', 'sineWavTab', 'pulseWavTab']   # in the order of wavBank[]
+KEEP = 50.0   # make a level only if it keeps at least this much (in %) of the sound
+
+
+def c_table(name, values, comment):
+    lines = ['// %s' % comment, 'const uint8_t %s[] PROGMEM = {' % name]
+    for i in range(0, len(values), 12):
+        lines.append('  ' + ', '.join('0x%02x' % v for v in values[i:i + 12]) + ',')
+    lines[-1] = lines[-1].rstrip(',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def harmonics(wav):
+    # the Fourier transform: (cos, sin) amounts of each harmonic, 0 (the average) to N/2
+    n = len(wav)
+    out = []
+    for h in range(n // 2 + 1):
+        c = sum(v * math.cos(2 * math.pi * h * i / n) for i, v in enumerate(wav)) / n
+        s = sum(v * math.sin(2 * math.pi * h * i / n) for i, v in enumerate(wav)) / n
+        out.append((c, s))
+    return out
+
+
+def shrink(wav, size):
+    # keep the harmonics that a table of "size" samples can hold (the top one,
+    # at exactly size/2, is left out, since it would only be sampled at its peaks or zeros),
+    # and sample what is left at "size" points
+    n = len(wav)
+    harm = harmonics(wav)
+    top = (size - 1) // 2
+    out = []
+    for j in range(size):
+        x = j * n / float(size)
+        v = harm[0][0]
+        for h in range(1, top + 1):
+            c, s = harm[h]
+            v += 2 * (c * math.cos(2 * math.pi * h * x / n) + s * math.sin(2 * math.pi * h * x / n))
+        out.append(max(0, min(255, int(round(v)))))
+    return out, top
+
+
+def power(wav):
+    mean = sum(wav) / float(len(wav))
+    return sum((v - mean) ** 2 for v in wav) / len(wav)
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else 'GumballSound.c'
+    levels = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+
+    report = []
+    names = []
+    print('#define MIP_LEVELS  %d   // (made by tools/wavmip.py)' % levels)
+    for name in TABLES:
+        wav = read_table(path, name)
+        if len(wav) % (1 << levels):
+            sys.exit("%s[] has %d samples, so it can't be halved %d times" % (name, len(wav), levels))
+        row = []
+        for level in range(1, levels + 1):
+            size = len(wav) >> level
+            mip, top = shrink(wav, size)
+            kept = 100.0 * power(mip) / power(wav)
+            mipname = '%sMip%d' % (name, level)
+            if row and row[-1] == '0' or kept < KEEP:
+                row.append('0')
+                report.append('//   %-14s level %d  %3d samples   kept %5.1f%%  (too little -- not made)'
+                              % (name, level, size, kept))
+                continue
+            print(c_table(mipname, mip, 'MIPMAP level %d: %d samples, harmonics 1 to %d (made by tools/wavmip.py)'
+                          % (level, size, top)))
+            row.append(mipname)
+            report.append('//   %-14s level %d  %3d samples   kept %5.1f%%' % (name, level, size, kept))
+        names.append(row)
+    print('// the levels of each wave table in wavBank[] (made by tools/wavmip.py)')
+    print('const uint8_t * const wavMip[][MIP_LEVELS] PROGMEM = {')
+    for i, (row, name) in enumerate(zip(names, TABLES)):
+        print('  { %s }%s  // %s[]' % (', '.join(row), ',' if i < len(names) - 1 else ' ', name))
+    print('};')
+    print()
+    print('// the levels, compared with the whole wave table:')
+    print('\n'.join(report))
+
+
+if __name__ == '__main__':
+    main()